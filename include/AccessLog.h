@@ -0,0 +1,79 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "Path.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Persistent record of the files that each command actually read the last
+ * time that it ran, as reported by the sandbox.  Commands are identified by
+ * their first product.
+ *
+ * This lets a command that declares a whole directory as an input be
+ * considered stale only when one of the files that it really used changes.
+ */
+class AccessLog
+{
+public:
+	typedef std::unordered_set<std::string> AccessSet;
+
+private:
+	typedef std::unordered_map<std::string, AccessSet> CommandMap;
+
+	Path logPath;
+	CommandMap commands;
+	bool dirty;
+
+	void Load();
+
+public:
+	explicit AccessLog(Path path);
+	~AccessLog();
+
+	AccessLog(const AccessLog &) = delete;
+	AccessLog(AccessLog &&) = delete;
+	AccessLog & operator=(const AccessLog &) = delete;
+	AccessLog & operator=(AccessLog &&) = delete;
+
+	/* Returns nullptr if we don't know what the command read. */
+	const AccessSet * Lookup(const Path & product) const;
+
+	void Record(const Path & product, const std::vector<Path> & accesses);
+	void Forget(const Path & product);
+
+	void Save();
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef BUILD_DAEMON_H
+#define BUILD_DAEMON_H
+
+#include "Event.h"
+#include "FileWatcher.h"
+#include "Path.h"
+#include "StatCache.h"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class EventLoop;
+
+/*
+ * What the daemon builds with.  The graph is loaded into the daemon once and
+ * is then inherited by a child process for each build, so a failed build
+ * (which exits) can't take the daemon down with it.
+ */
+class DaemonBuilder
+{
+public:
+	virtual ~DaemonBuilder() = default;
+
+	/*
+	 * Load the evaluated build graph into the daemon.  Returns false if
+	 * there is no usable graph; the next build then evaluates the build
+	 * scripts itself.  On success, scripts is set to the files the graph
+	 * was evaluated from.
+	 */
+	virtual bool LoadGraph(std::vector<Path> & scripts) = 0;
+
+	/* Returns false if any of those scripts changed after loading. */
+	virtual bool GraphIsCurrent() = 0;
+	virtual void DropGraph() = 0;
+
+	/* Called in the child process; returns its exit status. */
+	virtual int Build(const std::vector<std::string> & targets,
+	    StatCache & stats) = 0;
+};
+
+/*
+ * Keeps the build graph and the status of source files resident between
+ * builds, and builds targets requested by RunDaemonClient() over a unix
+ * socket.  Build scripts and sources are watched for changes, so only what
+ * changed since the last build is evaluated or probed again.
+ *
+ * Requests are served one at a time.
+ */
+class BuildDaemon : public Event
+{
+	DaemonBuilder & builder;
+	Path sockPath;
+	int listenFd;
+	StatCache statCache;
+	FileWatcher watcher;
+	std::unordered_set<Path> scripts;
+	bool graphLoaded;
+
+	void Listen();
+	void FileChanged(const Path & path);
+	void LoadGraph();
+	bool ReadRequest(int sock, std::vector<std::string> & targets, int fds[2]);
+	void HandleRequest(int sock);
+	int RunBuild(const std::vector<std::string> & targets, int outFd, int errFd);
+	void ReportMisses(int fd);
+	void WatchMisses(int fd);
+
+public:
+	BuildDaemon(EventLoop & loop, Path sock, DaemonBuilder & builder);
+	~BuildDaemon();
+
+	BuildDaemon(const BuildDaemon &) = delete;
+	BuildDaemon(BuildDaemon &&) = delete;
+	BuildDaemon & operator=(const BuildDaemon &) = delete;
+	BuildDaemon & operator=(BuildDaemon &&) = delete;
+
+	void Dispatch(int fd, short flags) override;
+};
+
+#endif
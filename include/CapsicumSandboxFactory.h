@@ -46,7 +46,7 @@ public:
 	CapsicumSandboxFactory();
 	~CapsicumSandboxFactory();
 
-	virtual Sandbox& MakeSandbox(uint64_t jid, const Command &command);
+	virtual Sandbox& MakeSandbox(uint64_t jid, Command &command);
 	virtual void ReleaseSandbox(uint64_t jid);
 
 };
@@ -29,6 +29,8 @@
 #ifndef PENDING_JOB_H
 #define PENDING_JOB_H
 
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -39,6 +41,7 @@
 
 class Job;
 class Product;
+class ResourcePool;
 
 typedef std::vector<Product*> ProductList;
 typedef std::vector<std::string> ArgList;
@@ -53,6 +56,42 @@ class Command : public JobCompletion
 	std::optional<Path> stdin;
 	std::optional<Path> stdout;
 	bool queued;
+	bool restat;
+	bool ephemeral;
+	bool jobServer;
+	std::optional<Path> depfile;
+
+	/*
+	 * The files that the command read when it last ran.  Only sandboxes
+	 * that see every open() can report these.
+	 */
+	bool accessesTracked;
+	std::vector<Path> accesses;
+
+	/*
+	 * The command whose stdout is piped into our stdin.  It isn't in the
+	 * graph; it runs alongside us as part of our job.
+	 */
+	std::unique_ptr<Command> upstream;
+	Command * downstream;
+
+	/*
+	 * The estimated time, in milliseconds, from when we start until every
+	 * target that depends on us is built, and how many products are
+	 * waiting directly on ours.  The job queue runs the longest chains
+	 * first.
+	 */
+	uint64_t criticalPath;
+	uint32_t fanOut;
+
+	/*
+	 * What the command needs to run: a slot in its pool, if it has one,
+	 * a number of the job slots, and an estimate of its memory use in
+	 * MiB.
+	 */
+	ResourcePool * pool;
+	uint32_t cpus;
+	uint64_t memory;
 
 public:
 	Command(ProductList && products, ArgList && a, PermissionList && p, Path && wd,
@@ -98,6 +137,76 @@ public:
 		return stdout;
 	}
 
+	const std::vector<Product*> & GetProducts() const
+	{
+		return products;
+	}
+
+	bool GetRestat() const
+	{
+		return restat;
+	}
+
+	void SetRestat(bool r)
+	{
+		restat = r;
+	}
+
+	bool IsEphemeral() const
+	{
+		return ephemeral;
+	}
+
+	void SetEphemeral(bool e)
+	{
+		ephemeral = e;
+	}
+
+	bool UsesJobServer() const
+	{
+		return jobServer;
+	}
+
+	void SetJobServer(bool j)
+	{
+		jobServer = j;
+	}
+
+	const std::optional<Path> & GetDepfile() const
+	{
+		return depfile;
+	}
+
+	void SetDepfile(std::optional<Path> && d)
+	{
+		depfile = std::move(d);
+	}
+
+	void TrackAccesses()
+	{
+		accessesTracked = true;
+		accesses.clear();
+	}
+
+	void AddAccess(Path && path)
+	{
+		/* What a pipeline reads is all read by its last command. */
+		if (downstream)
+			downstream->AddAccess(std::move(path));
+		else
+			accesses.push_back(std::move(path));
+	}
+
+	bool AccessesTracked() const
+	{
+		return accessesTracked;
+	}
+
+	const std::vector<Path> & GetAccesses() const
+	{
+		return accesses;
+	}
+
 	bool WasQueued() const
 	{
 		return queued;
@@ -107,6 +216,55 @@ public:
 	{
 		queued = true;
 	}
+
+	uint64_t GetCriticalPath() const
+	{
+		return criticalPath;
+	}
+
+	uint32_t GetFanOut() const
+	{
+		return fanOut;
+	}
+
+	void SetPriority(uint64_t path, uint32_t fan)
+	{
+		criticalPath = path;
+		fanOut = fan;
+	}
+
+	ResourcePool * GetPool() const
+	{
+		return pool;
+	}
+
+	uint32_t GetCpus() const
+	{
+		return cpus;
+	}
+
+	uint64_t GetMemory() const
+	{
+		return memory;
+	}
+
+	void SetResources(ResourcePool * p, uint32_t c, uint64_t mem)
+	{
+		pool = p;
+		cpus = c;
+		memory = mem;
+	}
+
+	Command * GetUpstream() const
+	{
+		return upstream.get();
+	}
+
+	void SetUpstream(std::unique_ptr<Command> && command)
+	{
+		upstream = std::move(command);
+		upstream->downstream = this;
+	}
 };
 
 typedef std::unique_ptr<Command> CommandPtr;
@@ -35,12 +35,15 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class Command;
+class GraphCache;
 class Product;
 class PermissionList;
 class ProductManager;
+class ResourcePool;
 
 struct CommandOptions
 {
@@ -51,25 +54,171 @@ struct CommandOptions
 	std::vector<std::string> statdirs;
 	std::vector<std::string> orderDeps;
 	std::vector<std::string> targetList;
+
+	/*
+	 * After the command runs, check whether it actually changed its
+	 * products; if not, don't rebuild what depends on them.
+	 */
+	bool restat;
+
+	/*
+	 * The products are only read by the commands that depend on them,
+	 * so delete them once those commands have run.
+	 */
+	bool ephemeral;
+
+	/*
+	 * Rather than writing stdout to a file, pipe it into the command
+	 * that takes the same path as its stdin, which must be defined
+	 * later.  The two run together as one job.
+	 */
+	bool stream;
+
+	/*
+	 * The command is a make (or another tool that speaks the GNU make
+	 * jobserver protocol), and takes its job slots from ours.
+	 */
+	bool jobserver;
+
+	/*
+	 * A Makefile-style dependency file written by the command, listing
+	 * inputs (e.g. headers) that weren't declared.
+	 */
+	std::optional<Path> depfile;
+
+	/*
+	 * The pool (see factory.define_pool()) that limits how many commands
+	 * like this one run at once, if any.  cpus is how many of the job
+	 * slots the command takes, and memory how many MiB it is expected to
+	 * use; jobs are only started while they fit in what is left.
+	 */
+	std::string pool;
+	uint32_t cpus;
+	uint64_t memory;
+
+	CommandOptions()
+	  : restat(false),
+	    ephemeral(false),
+	    stream(false),
+	    jobserver(false),
+	    cpus(1),
+	    memory(0)
+	{
+	}
+};
+
+/* Is told about every command as soon as it has been defined. */
+class CommandListener
+{
+public:
+	virtual void CommandAdded(Command * command,
+	    const std::vector<Product*> & inputs) = 0;
 };
 
 class CommandFactory
 {
 	ProductManager &productManager;
+	GraphCache *graphCache;
+	CommandListener *listener;
 	Path factoryWorkDir;
 	std::vector<std::unique_ptr<Command>> commandList;
 	std::vector<Path> shellPath;
+	std::string configuration;
+
+	/* A streaming command, waiting for the command that reads it. */
+	struct PendingStream
+	{
+		std::unique_ptr<Command> command;
+		std::vector<Product*> inputs;
+		uint64_t definition;
+	};
+	std::unordered_map<Path, PendingStream> streams;
+
+	/*
+	 * Every path that a command streams, which no product can be made
+	 * for; the commands reading it get its data on stdin instead.
+	 */
+	std::unordered_set<Path> streamed;
+
+	/*
+	 * A digest of how each command was defined, and the configuration
+	 * that first defined it.
+	 */
+	struct Definition
+	{
+		uint64_t digest;
+		std::string configuration;
+	};
+	std::unordered_map<const Command*, Definition> definitions;
+
+	std::unordered_map<std::string, std::unique_ptr<ResourcePool>> pools;
 
 	static std::vector<Path> GetShellPath();
 
 	Path GetExecutablePath(Path path);
+	void AddToTargets(const std::vector<Product*> & products,
+	    const std::vector<std::string> & targets);
+	void CheckNotStreamed(const Path & path,
+	    const std::string & command) const;
+	uint64_t DigestDefinition(const std::vector<Path> & products,
+	    const std::vector<std::string> & inputs,
+	    const std::vector<std::string> & argList, const Path & workdir,
+	    const CommandOptions & options) const;
+	bool IsSharedCommand(const std::vector<Path> & products,
+	    const std::vector<std::string> & argList, const Path & workdir,
+	    uint64_t definition, const std::vector<std::string> & targets);
+
+	ResourcePool * FindPool(const std::string & name,
+	    const std::string & command) const;
 
 public:
-	CommandFactory(ProductManager &);
+	CommandFactory(ProductManager &, GraphCache * cache = nullptr);
+	~CommandFactory();
+
 	void AddCommand(const std::vector<std::string> & products,
 	    const std::vector<std::string> & inputs,
 	    std::vector<std::string> && argList,
 	    CommandOptions && options);
+	void AddInputRoot(const std::string & path,
+	    const std::optional<Path> & stamp);
+
+	/* Commands must name a pool only after it has been added. */
+	void AddPool(const std::string & name, uint32_t depth);
+
+	/*
+	 * Once every command has been added, check that something reads
+	 * the stdout of each streaming command.
+	 */
+	void CheckStreams() const;
+
+	/* Resolve a path from a build script against factory's directory. */
+	Path MakeAbsolute(const Path & path) const
+	{
+		if (path.is_relative())
+			return factoryWorkDir / path;
+		return path;
+	}
+
+	/*
+	 * Commands added from now on belong to the named configuration.  Its
+	 * products are added to "<name>:<target>" as well as to each target
+	 * that they list.  An empty name means that there is only one
+	 * configuration.
+	 */
+	void SetConfiguration(const std::string & name)
+	{
+		configuration = name;
+	}
+
+	const std::string & GetConfiguration() const
+	{
+		return configuration;
+	}
+
+	void SetListener(CommandListener * l)
+	{
+		listener = l;
+	}
 };
 
 #endif
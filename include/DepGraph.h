@@ -0,0 +1,214 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DEP_GRAPH_H
+#define DEP_GRAPH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class Product;
+
+/*
+ * The dependency edges between products.  While the graph is being built,
+ * edges are only appended to a list.  Once every edge is known, Freeze()
+ * sorts them into compressed sparse row form: for each product, its inputs
+ * (and separately its dependees) are a contiguous slice of one shared
+ * array.
+ *
+ * Readiness is tracked with a per-product count of inputs that have yet to
+ * be built, rather than a set of them.
+ */
+class DepGraph
+{
+public:
+	class Range
+	{
+		Product * const * first;
+		Product * const * last;
+
+	public:
+		Range(Product * const * f, Product * const * l)
+		  : first(f),
+		    last(l)
+		{
+		}
+
+		Product * const * begin() const
+		{
+			return first;
+		}
+
+		Product * const * end() const
+		{
+			return last;
+		}
+
+		size_t size() const
+		{
+			return last - first;
+		}
+
+		bool empty() const
+		{
+			return first == last;
+		}
+
+		Product * front() const
+		{
+			return *first;
+		}
+	};
+
+	/* The pending count of a product that we will not build. */
+	static constexpr uint32_t UNSCHEDULED = UINT32_MAX;
+
+private:
+	typedef std::pair<Product*, Product*> Edge;
+
+	/* (product, input) pairs; only valid before Freeze(). */
+	std::vector<Edge> edges;
+
+	/* Indexed by graph index. */
+	std::vector<Product*> nodes;
+	std::vector<uint32_t> inputOffsets;
+	std::vector<Product*> inputs;
+	std::vector<uint32_t> dependeeOffsets;
+	std::vector<Product*> dependees;
+	std::unique_ptr<std::atomic<uint32_t>[]> pending;
+	bool frozen;
+
+	static Range Slice(const std::vector<uint32_t> & offsets,
+	    const std::vector<Product*> & list, uint32_t node);
+
+public:
+	static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+	DepGraph();
+
+	DepGraph(const DepGraph &) = delete;
+	DepGraph(DepGraph &&) = delete;
+	DepGraph & operator=(const DepGraph &) = delete;
+	DepGraph & operator=(DepGraph &&) = delete;
+
+	void AddEdge(Product * product, Product * input);
+
+	/*
+	 * Group the edges added so far by product, for ForEachInput().  This
+	 * must be called again after adding more edges.
+	 */
+	void SortEdges();
+
+	/* Call func(input) for each input of product; only before Freeze(). */
+	template <typename F>
+	void ForEachInput(Product * product, const F & func) const
+	{
+		auto it = std::lower_bound(edges.begin(), edges.end(), product,
+		    [](const Edge & edge, Product * p)
+		    {
+			return std::less<Product*>()(edge.first, p);
+		    });
+
+		for (; it != edges.end() && it->first == product; ++it) {
+			func(it->second);
+		}
+	}
+
+	template <typename F>
+	void ForEachEdge(const F & func) const
+	{
+		for (const Edge & edge : edges) {
+			func(edge.first, edge.second);
+		}
+	}
+
+	/*
+	 * Replace the input of every edge added so far with func(input), or
+	 * drop the edge if that returns nullptr.  This lets edges be declared
+	 * before we know what their inputs really are (e.g. whether they are
+	 * directories).
+	 */
+	template <typename F>
+	void RewriteInputs(const F & func)
+	{
+		auto out = edges.begin();
+		for (Edge & edge : edges) {
+			Product * input = func(edge.second);
+			if (input) {
+				*out = Edge(edge.first, input);
+				++out;
+			}
+		}
+		edges.erase(out, edges.end());
+	}
+
+	/*
+	 * Build the adjacency arrays.  Each product in nodes must already have
+	 * its index in nodes as its graph index.  Duplicate edges and edges
+	 * from a product to itself are dropped.
+	 */
+	void Freeze(const std::vector<Product*> & nodes);
+
+	bool IsFrozen() const
+	{
+		return frozen;
+	}
+
+	Range Inputs(uint32_t node) const;
+	Range Dependees(uint32_t node) const;
+
+	/*
+	 * Returns every dependency cycle reachable from roots, as the set of
+	 * products that are in it.  This takes time linear in the number of
+	 * reachable edges and does not recurse.
+	 */
+	std::vector<std::vector<Product*>> FindCycles(const std::vector<Product*> & roots) const;
+
+	void SetPending(uint32_t node, uint32_t count)
+	{
+		pending[node].store(count, std::memory_order_relaxed);
+	}
+
+	uint32_t GetPending(uint32_t node) const
+	{
+		return pending[node].load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * Record that one of node's inputs has been built.  Returns true if
+	 * that was the last input node was waiting for.
+	 */
+	bool InputComplete(uint32_t node);
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DEPS_LOG_H
+#define DEPS_LOG_H
+
+#include "Path.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Persistent record of the dependencies that compilers reported in depfiles,
+ * keyed by the command's first product.
+ *
+ * Every path is stored once, no matter how many products depend on it, and
+ * each product's dependencies are a list of indices into the path table.
+ */
+class DepsLog
+{
+	typedef std::vector<uint32_t> DepList;
+	typedef std::unordered_map<uint32_t, DepList> RecordMap;
+
+	Path logPath;
+	std::vector<std::string> paths;
+	std::unordered_map<std::string, uint32_t> pathIds;
+	RecordMap records;
+	bool dirty;
+
+	uint32_t InternPath(const std::string & path);
+	void Load();
+
+public:
+	explicit DepsLog(Path path);
+	~DepsLog();
+
+	DepsLog(const DepsLog &) = delete;
+	DepsLog(DepsLog &&) = delete;
+	DepsLog & operator=(const DepsLog &) = delete;
+	DepsLog & operator=(DepsLog &&) = delete;
+
+	/* Returns false if nothing was recorded for the product. */
+	bool GetDeps(const Path & product, std::vector<Path> & deps) const;
+
+	void Record(const Path & product, const std::vector<Path> & deps);
+	void Forget(const Path & product);
+
+	void Save();
+};
+
+#endif
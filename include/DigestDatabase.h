@@ -0,0 +1,138 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DIGEST_DATABASE_H
+#define DIGEST_DATABASE_H
+
+#include "Path.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Persistent database of file content digests, used to decide staleness by
+ * content rather than by modification time.
+ *
+ * Digests of files are cached along with the (dev, inode, size, mtime) of the
+ * file when it was hashed, so a file is only rehashed if that key changes.  For
+ * every product that was successfully built, the database also records the
+ * digest of every input as it was when the product was built.
+ */
+class DigestDatabase
+{
+	struct FileKey
+	{
+		uint64_t dev;
+		uint64_t ino;
+		int64_t size;
+		int64_t mtimeSec;
+		int64_t mtimeNsec;
+
+		bool operator==(const FileKey & rhs) const
+		{
+			return dev == rhs.dev && ino == rhs.ino && size == rhs.size &&
+			    mtimeSec == rhs.mtimeSec && mtimeNsec == rhs.mtimeNsec;
+		}
+	};
+
+	struct FileEntry
+	{
+		FileKey key;
+		uint64_t digest;
+	};
+
+	typedef std::unordered_map<std::string, FileEntry> FileMap;
+	typedef std::unordered_map<std::string, uint64_t> InputDigestMap;
+	typedef std::unordered_map<std::string, InputDigestMap> BuildMap;
+
+	/*
+	 * The inputs of a product whose command is running, as they were
+	 * when it started.
+	 */
+	struct RunningBuild
+	{
+		int64_t startSec;
+		FileMap inputs;
+	};
+
+	Path dbPath;
+	FileMap files;
+	BuildMap builds;
+	std::unordered_map<std::string, RunningBuild> running;
+	bool dirty;
+
+	static bool GetFileKey(const Path & path, FileKey & key);
+	bool LookupDigest(const std::string & path, const FileKey & key, uint64_t & digest) const;
+	bool GetEntry(const Path & path, FileEntry & entry);
+
+	void Load();
+
+public:
+	explicit DigestDatabase(Path path);
+	~DigestDatabase();
+
+	DigestDatabase(const DigestDatabase &) = delete;
+	DigestDatabase(DigestDatabase &&) = delete;
+	DigestDatabase & operator=(const DigestDatabase &) = delete;
+	DigestDatabase & operator=(DigestDatabase &&) = delete;
+
+	/*
+	 * Make sure that the digests for all of the given files are cached,
+	 * hashing any that need it in parallel.
+	 */
+	void Prefetch(const std::vector<Path> & paths);
+
+	/* Returns false if the file can't be read. */
+	bool GetDigest(const Path & path, uint64_t & digest);
+
+	bool HasBuildRecord(const Path & product) const
+	{
+		return builds.count(product.string()) != 0;
+	}
+
+	/*
+	 * Returns true if the contents of input differ from when product was
+	 * last successfully built, or if we have no record of that.
+	 */
+	bool InputChanged(const Path & product, const Path & input);
+
+	/*
+	 * Note the digests of the inputs of product just before its command
+	 * starts.  RecordBuild() records those, and leaves out any input that
+	 * changed while the command ran, as we can't tell which contents the
+	 * command read.
+	 */
+	void BuildStarted(const Path & product, const std::vector<Path> & inputs);
+	void RecordBuild(const Path & product, const std::vector<Path> & inputs);
+
+	void Save();
+};
+
+#endif
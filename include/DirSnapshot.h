@@ -0,0 +1,123 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef DIR_SNAPSHOT_H
+#define DIR_SNAPSHOT_H
+
+#include "Path.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*
+ * An in-memory copy of the directory trees beneath a set of roots.  Each
+ * directory is read exactly once, no matter how many roots contain it, and
+ * reads are spread across threads.  Symlinks to directories are followed,
+ * but a directory reached a second time (e.g. through a symlink loop) is not
+ * descended into again.
+ */
+class DirSnapshot
+{
+private:
+	struct DirEntries
+	{
+		bool readable;
+		uint64_t dev;
+		uint64_t ino;
+
+		/* Sorted, so that Lookup() can binary search them. */
+		std::vector<std::string> files;
+		std::vector<std::string> subdirs;
+
+		/*
+		 * Set if the same directory was already read through another
+		 * path; the entries live under that path instead.
+		 */
+		Path aliasOf;
+
+		DirEntries()
+		  : readable(false),
+		    dev(0),
+		    ino(0)
+		{
+		}
+	};
+
+	struct DirIdHash
+	{
+		size_t operator()(const std::pair<uint64_t, uint64_t> & id) const
+		{
+			return std::hash<uint64_t>()(id.first) ^
+			    (std::hash<uint64_t>()(id.second) * 31);
+		}
+	};
+
+	typedef std::pair<uint64_t, uint64_t> DirId;
+	typedef std::unordered_set<DirId, DirIdHash> DirIdSet;
+	typedef std::unordered_map<Path, DirEntries> DirMap;
+
+	DirMap dirs;
+	std::unordered_map<DirId, Path, DirIdHash> dirPaths;
+
+	static void ReadDir(const Path & path, DirEntries & entries);
+	static bool IsDirectory(int dirfd, const char * name);
+
+	DirMap::const_iterator Find(const Path & path) const;
+	void CollectFiles(const Path & dir, DirMap::const_iterator it,
+	    DirIdSet & ancestors, std::vector<Path> & files) const;
+
+public:
+	DirSnapshot() = default;
+
+	DirSnapshot(const DirSnapshot &) = delete;
+	DirSnapshot(DirSnapshot &&) = delete;
+	DirSnapshot &operator=(const DirSnapshot &) = delete;
+	DirSnapshot &operator=(DirSnapshot &&) = delete;
+
+	/* Read every directory beneath the roots that has not been read yet. */
+	void Walk(const std::vector<Path> & roots);
+
+	/*
+	 * Append every non-directory beneath dir to files, under every path
+	 * that reaches it short of a symlink loop.  dir must have been covered
+	 * by an earlier Walk(); unreadable directories are skipped.
+	 */
+	void GetFiles(const Path & dir, std::vector<Path> & files) const;
+
+	/*
+	 * Answer whether path exists from memory.  Returns false if the
+	 * snapshot does not cover path's parent directory.
+	 */
+	bool Lookup(const Path & path, bool & exists) const;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef EAGER_BUILDER_H
+#define EAGER_BUILDER_H
+
+#include "CommandFactory.h"
+#include "JobCompletion.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Command;
+class EventLoop;
+class JobManager;
+class Product;
+class ProductManager;
+
+/*
+ * Starts commands while the build scripts are still being evaluated, rather
+ * than waiting for the whole graph.  The build then runs as usual once every
+ * script has been evaluated, and will find the eagerly built products up to
+ * date.
+ *
+ * A later script can still add to what a command depends on, so only
+ * products that don't exist yet are built eagerly: an extra dependency can
+ * make such a product out of date (in which case the build redoes it), but
+ * never needlessly missing.  A command only starts once all of its inputs
+ * exist or were built eagerly, and only if a requested target needs it.
+ */
+class EagerBuilder : public CommandListener
+{
+	class EagerJob : public JobCompletion
+	{
+		EagerBuilder & builder;
+		Command * command;
+
+	public:
+		EagerJob(EagerBuilder & b, Command * c)
+		  : builder(b),
+		    command(c)
+		{
+		}
+
+		void JobComplete(Job * job, int status) override;
+		void Abort() override;
+	};
+
+	struct CommandInfo
+	{
+		std::vector<Product*> inputs;
+		std::vector<Product*> parents;
+		bool wanted;
+		bool built;
+
+		CommandInfo()
+		  : wanted(false),
+		    built(false)
+		{
+		}
+	};
+
+	enum class Readiness
+	{
+		READY,
+		WAITING,
+		NEVER,
+	};
+
+	EventLoop & loop;
+	JobManager & jobManager;
+	ProductManager & productManager;
+	std::vector<std::string> targets;
+	std::unordered_map<std::string, size_t> targetsSeen;
+
+	std::unordered_map<Command*, CommandInfo> commands;
+	std::unordered_set<const Product*> wantedInputs;
+	std::unordered_set<const Product*> sources;
+
+	/* Wanted commands that might be ready to start. */
+	std::vector<Command*> candidates;
+
+	/* Commands waiting for a command that is being built eagerly. */
+	std::unordered_map<Command*, std::vector<Command*>> waiters;
+
+	std::vector<std::unique_ptr<EagerJob>> jobs;
+	size_t running;
+	bool stopped;
+
+	void MarkWanted(Command * command);
+	void AddTargetCommands();
+	Readiness CheckReady(Command * command, Command *& blocker);
+	Readiness InputReady(Product * input, bool isParent, Command *& blocker);
+	void StartReady();
+	void JobDone(Command * command, int status, uint64_t jobId);
+
+public:
+	EagerBuilder(EventLoop & loop, JobManager & jobs, ProductManager & mgr,
+	    const std::unordered_set<std::string_view> & targets);
+
+	EagerBuilder(const EagerBuilder &) = delete;
+	EagerBuilder(EagerBuilder &&) = delete;
+	EagerBuilder & operator=(const EagerBuilder &) = delete;
+	EagerBuilder & operator=(EagerBuilder &&) = delete;
+
+	void CommandAdded(Command * command,
+	    const std::vector<Product*> & inputs) override;
+
+	/*
+	 * Reap finished jobs and start whatever has become ready.  This is
+	 * called between build scripts.
+	 */
+	void Update();
+
+	/* Wait for every eager job to finish, and start no more. */
+	void Finish();
+};
+
+#endif
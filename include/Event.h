@@ -55,6 +55,9 @@ public:
 		return ev;
 	}
 
+	void Enable();
+	void Disable();
+
 	virtual void Dispatch(int fd, short flags) = 0;
 };
 
@@ -53,8 +53,17 @@ public:
 	void RegisterListenSocket(Event *, int fd);
 	void RegisterSocket(Event *, int fd);
 
+	/* Watch fd for reads, once the event is enabled. */
+	void RegisterPipe(Event *, int fd);
+
+	/* Dispatch the event every interval, with fd -1. */
+	void RegisterTimer(Event *, const struct timeval & interval);
+
 	void Run();
 
+	/* Handle any events that are already pending, without blocking. */
+	void Poll();
+
 	void SignalExit();
 };
 
@@ -0,0 +1,82 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include "Event.h"
+#include "Path.h"
+
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+class EventLoop;
+
+/*
+ * Watches files and directories with kqueue, and calls back once for each
+ * watched path that is modified, renamed, deleted or has its attributes
+ * changed.  A path is no longer watched after its callback; watch it again
+ * to learn of further changes.
+ *
+ * Each watch holds an open file descriptor, so the number of paths that can
+ * be watched is limited by RLIMIT_NOFILE.
+ */
+class FileWatcher : public Event
+{
+public:
+	typedef std::function<void(const Path &)> Callback;
+
+private:
+	int kq;
+	Callback callback;
+	std::unordered_map<int, Path> watches;
+	std::unordered_set<Path> watched;
+
+public:
+	FileWatcher(EventLoop & loop, Callback cb);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher(FileWatcher &&) = delete;
+	FileWatcher & operator=(const FileWatcher &) = delete;
+	FileWatcher & operator=(FileWatcher &&) = delete;
+
+	/*
+	 * Returns false if the path can't be watched.  Watching a path that
+	 * is already watched does nothing.
+	 */
+	bool Watch(const Path & path);
+
+	/* Deliver every change that has already happened, without blocking. */
+	void Poll();
+
+	void Dispatch(int fd, short flags) override;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef GRAPH_CACHE_H
+#define GRAPH_CACHE_H
+
+#include "CommandFactory.h"
+#include "Path.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class StateFileReader;
+class StateFileWriter;
+
+/*
+ * Records every command defined while evaluating the build scripts, along
+ * with the set of scripts and configs that were read to produce them.  On a
+ * later run, if none of those files (nor the environment) have changed, the
+ * commands are replayed directly into the CommandFactory and the Lua
+ * evaluation is skipped entirely.
+ *
+ * Note that the cache can't see anything a script reads behind factory's
+ * back (e.g. through the io library, or files pulled in by a UCL .include
+ * directive); scripts that do so must be run with the cache disabled.
+ */
+class GraphCache
+{
+	struct ScriptInput
+	{
+		std::string path;
+		int64_t mtimeSec;
+		int64_t mtimeNsec;
+		int64_t size;
+
+		bool operator==(const ScriptInput & rhs) const
+		{
+			return path == rhs.path && mtimeSec == rhs.mtimeSec &&
+			    mtimeNsec == rhs.mtimeNsec && size == rhs.size;
+		}
+	};
+
+	struct CachedCommand
+	{
+		std::vector<std::string> products;
+		std::vector<std::string> inputs;
+		std::vector<std::string> argList;
+		CommandOptions options;
+		std::string configuration;
+	};
+
+	struct CachedInputRoot
+	{
+		std::string path;
+		std::optional<Path> stamp;
+	};
+
+	struct CachedPool
+	{
+		std::string name;
+		uint32_t depth;
+	};
+
+	Path cachePath;
+	std::string workdir;
+	uint64_t envHash;
+	std::vector<std::string> configurations;
+	std::vector<ScriptInput> scripts;
+	std::vector<CachedCommand> commands;
+	std::vector<CachedInputRoot> inputRoots;
+	std::vector<CachedPool> pools;
+	bool replaying;
+
+	static uint64_t HashEnvironment();
+	static bool StatScript(const std::string & path, ScriptInput & input);
+
+	static void WriteOptional(StateFileWriter &, const std::optional<Path> &);
+	static std::optional<Path> ReadOptional(StateFileReader &);
+
+	bool ReadCommands(StateFileReader & reader);
+	bool ReadInputRoots(StateFileReader & reader);
+	bool ReadPools(StateFileReader & reader);
+
+public:
+	explicit GraphCache(Path path);
+
+	GraphCache(const GraphCache &) = delete;
+	GraphCache(GraphCache &&) = delete;
+	GraphCache & operator=(const GraphCache &) = delete;
+	GraphCache & operator=(GraphCache &&) = delete;
+
+	/*
+	 * The cache is only valid for the same set of configurations, in the
+	 * same order.
+	 */
+	void SetConfigurations(const std::vector<std::string> & names)
+	{
+		configurations = names;
+	}
+
+	void AddScript(const std::string & path);
+	void RecordCommand(const std::vector<std::string> & products,
+	    const std::vector<std::string> & inputs,
+	    const std::vector<std::string> & argList,
+	    const CommandOptions & options,
+	    const std::string & configuration);
+
+	void RecordInputRoot(const std::string & path,
+	    const std::optional<Path> & stamp);
+
+	void RecordPool(const std::string & name, uint32_t depth);
+
+	/*
+	 * Returns true if the cache was valid and all of its commands were
+	 * added to the factory.  On failure, no commands have been added.
+	 */
+	bool Load(CommandFactory & factory);
+	void Save();
+
+	/* The scripts and configs that the graph was evaluated from. */
+	std::vector<Path> GetScripts() const;
+
+	/* Returns false if any of those have changed since. */
+	bool IsCurrent() const;
+};
+
+#endif
@@ -24,7 +24,9 @@
 #ifndef HASHUTIL_H
 #define HASHUTIL_H
 
+#include <cstdint>
 #include <functional>
+#include <string_view>
 #include <vector>
 
 /* Shamelessly stolen from boost::hash_combine. */
@@ -53,6 +55,20 @@ struct VectorHasher
 	}
 };
 
+/*
+ * 64-bit FNV-1a.  Unlike std::hash, the result is stable across runs and
+ * implementations, so it's suitable for hashes that are persisted to disk.
+ */
+inline uint64_t
+fnv1a_hash(std::string_view str, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+	for (unsigned char c : str) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
 
 #endif // HASHUTIL_H
 
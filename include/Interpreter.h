@@ -32,6 +32,7 @@
 
 #include "ConfigNode.h"
 #include "IngestManager.h"
+#include "Path.h"
 #include "Visitor.h"
 
 #include <deque>
@@ -57,12 +58,20 @@ namespace Lua
 
 struct IncludeFile
 {
-	enum Type { CONFIG, SCRIPT };
+	enum Type { CONFIG, SCRIPT, MANIFEST };
 
 	std::vector<std::string> paths;
 	const Type type;
 	std::unique_ptr<ConfigNode> config;
 
+	/*
+	 * What the include declared that it contributes to the build: the
+	 * targets that it adds commands to, and the directories that all of
+	 * its products are under.
+	 */
+	std::vector<std::string> targets;
+	std::vector<Path> outputs;
+
 	IncludeFile(const std::vector<std::string> && p, Type t, std::unique_ptr<ConfigNode> && c)
 	  : paths(p),
 	    type(t),
@@ -71,6 +80,12 @@ struct IncludeFile
 	}
 
 	IncludeFile(IncludeFile &&) = default;
+
+	/* Can the include be left out of builds that don't need it? */
+	bool IsLazy() const
+	{
+		return !targets.empty() || !outputs.empty();
+	}
 };
 
 class Interpreter
@@ -92,7 +107,8 @@ class Interpreter
 		friend class Interpreter;
 
 	public:
-		void operator()(int value) const;
+		void operator()(int64_t value) const;
+		void operator()(bool value) const;
 		void operator()(const std::string & value) const;
 		void operator()(const ConfigNodeList & value) const;
 		void operator()(const ConfigPairMap & value) const;
@@ -123,6 +139,8 @@ class Interpreter
 
 	int AddDefinitions();
 	int DefineCommand();
+	int DefineInputRoot();
+	int DefinePool();
 	int EvaluateVars();
 	template <IncludeFile::Type type>
 	int Include();
@@ -146,12 +164,16 @@ class Interpreter
 	
 	CommandOptions GetCommandOptions(Lua::Table &);
 
+	auto BoolField(bool & value);
 	auto FunctionField(Lua::Function & func);
 	auto StringListField(std::vector<std::string> & list);
 
 	template <typename T>
 	auto StringField(T &);
 
+	template <typename T>
+	auto IntField(T &);
+
 	typedef int (Interpreter::*LuaFuncImpl)();
 
 	template <LuaFuncImpl F>
@@ -167,6 +189,12 @@ public:
 	Interpreter &operator=(Interpreter &&) = delete;
 
 	void RunFile(const std::string & path, const ConfigNode & config);
+
+	/*
+	 * Make the parameters of the configuration that is being evaluated
+	 * visible to scripts as factory.configuration.
+	 */
+	void SetConfiguration(const std::string & name, const ConfigNode & params);
 	void ProcessConfig(const ConfigNode & parent, const std::vector<ConfigNodePtr> & config);
 
 	std::optional<IncludeFile> GetNextInclude();
@@ -30,11 +30,13 @@
 #define JOB_H
 
 #include <stdint.h>
+#include <time.h>
 #include <memory>
 #include <vector>
 
 #include "Path.h"
 
+class Command;
 class JobCompletion;
 class PermissionList;
 
@@ -42,12 +44,19 @@ class Job
 {
 private:
 	JobCompletion &completer;
+	const Command & command;
 	uint64_t jobId;
 	pid_t pid;
 	Path workdir;
 
+	/* The commands piping their output into this one. */
+	std::vector<pid_t> upstream;
+	size_t running;
+	int status;
+	struct timespec start;
+
 public:
-	Job(JobCompletion &, int id, pid_t pid, Path wd);
+	Job(JobCompletion &, const Command &, int id, pid_t pid, Path wd);
 	~Job();
 
 	Job(const Job &) = delete;
@@ -58,6 +67,27 @@ public:
 	void Complete(int status);
 	void Abort();
 
+	void AddUpstream(pid_t upstreamPid);
+
+	/*
+	 * Returns true once every process in the job has exited.  The job
+	 * fails if any of them did.
+	 */
+	bool ProcessExited(int exitStatus);
+
+	/* How long the job has been running, in milliseconds. */
+	uint64_t GetElapsed() const;
+
+	const Command & GetCommand() const
+	{
+		return command;
+	}
+
+	int GetStatus() const
+	{
+		return status;
+	}
+
 	int GetJobId() const
 	{
 		return jobId;
@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef JOB_HISTORY_H
+#define JOB_HISTORY_H
+
+#include "Path.h"
+
+#include <cstdint>
+#include <unordered_map>
+
+class Command;
+
+/*
+ * Persistent record of how long each command took the last time that it
+ * succeeded, keyed by a fingerprint of the command line, so that the
+ * scheduler can start the commands on the longest chains first.
+ *
+ * Changing a command makes it a new one, so entries that no build has
+ * looked up in a while are dropped.  A build of some of the targets
+ * doesn't drop the entries of the others right away.
+ */
+class JobHistory
+{
+	struct Entry
+	{
+		uint64_t msec;
+
+		/* The last build that looked the command up. */
+		uint32_t lastUsed;
+	};
+
+	typedef std::unordered_map<uint64_t, Entry> DurationMap;
+
+	Path historyPath;
+	DurationMap durations;
+
+	/* Counts the builds that have saved the history. */
+	uint32_t build;
+	bool dirty;
+
+	void Load();
+
+public:
+	explicit JobHistory(Path path);
+	~JobHistory();
+
+	JobHistory(const JobHistory &) = delete;
+	JobHistory(JobHistory &&) = delete;
+	JobHistory & operator=(const JobHistory &) = delete;
+	JobHistory & operator=(JobHistory &&) = delete;
+
+	/*
+	 * Identifies a command across builds.  Changing anything about how it
+	 * is run, including the commands streaming into it, makes it a new
+	 * command.
+	 */
+	static uint64_t Fingerprint(const Command & command);
+
+	/* Returns false if the command has never succeeded. */
+	bool GetDuration(const Command & command, uint64_t & msec);
+
+	void Record(const Command & command, uint64_t msec);
+
+	void Save();
+};
+
+#endif
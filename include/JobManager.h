@@ -31,18 +31,23 @@
 
 #include "Event.h"
 #include "Command.h"
+#include "Path.h"
 
 #include <sys/types.h>
 
+#include <deque>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class EventLoop;
 class Job;
 class JobCompletion;
+class JobHistory;
 class JobQueue;
+class JobServer;
 class SandboxFactory;
 
 class JobManager : private Event
@@ -50,15 +55,49 @@ class JobManager : private Event
 private:
 	typedef std::unordered_map<pid_t, std::unique_ptr<Job>> PidMap;
 
+	/* A process piping its output into the last command of a job. */
+	struct UpstreamProcess
+	{
+		Job * job;
+		uint64_t sandboxId;
+	};
+	typedef std::unordered_map<pid_t, UpstreamProcess> UpstreamMap;
+
 	PidMap pidMap;
+	UpstreamMap upstreamMap;
 	EventLoop &loop;
 	JobQueue & jobQueue;
 	std::unique_ptr<SandboxFactory> sandboxFactory;
-	const size_t maxRunning;
+	size_t maxRunning;
+
+	/*
+	 * The job slots and MiB of memory that running commands asked for,
+	 * and how much memory they may ask for between them.
+	 */
+	size_t cpusInUse;
+	uint64_t memoryInUse;
+	uint64_t memoryLimit;
 
 	uint64_t next_job_id;
+	JobHistory * history;
+	JobServer * jobServer;
+
+	/*
+	 * Inputs of queued commands that are still to be read ahead, and
+	 * every input that has been queued for it.
+	 */
+	std::deque<Path> prefetchQueue;
+	std::unordered_set<Path> prefetched;
 
 	uint64_t AllocJobId();
+	pid_t Spawn(Command & command, uint64_t jobId, int stdinFd, int stdoutFd);
+	Job * FindExited(pid_t pid);
+	void PrefetchInputs();
+
+	static uint64_t GetPhysicalMemory();
+	void AcquireResources(const Command & command);
+	void ReleaseResources(const Command & command);
+	void ReleaseTokens();
 
 public:
 	JobManager(EventLoop &, JobQueue &, std::unique_ptr<SandboxFactory> &&, size_t max);
@@ -69,8 +108,55 @@ public:
 	JobManager & operator=(const JobManager &) = delete;
 	JobManager & operator=(JobManager &&) = delete;
 
+	/* Record how long every command that succeeds takes to run. */
+	void SetJobHistory(JobHistory * h)
+	{
+		history = h;
+	}
+
+	/*
+	 * Take a jobserver token for every job after the first, and pass the
+	 * jobserver on to the commands that ask for it.
+	 */
+	void SetJobServer(JobServer * js);
+
 	Job * StartJob(Command &, JobCompletion &);
 
+	/*
+	 * Is there room for the command in its pool, the job slots and the
+	 * memory limit?  StartJob() doesn't check.
+	 */
+	bool CanStart(const Command & command) const;
+
+	/*
+	 * Every running job but one holds a jobserver token.  Take the token
+	 * for one more job, if it needs one; if none is free, the jobserver's
+	 * listener is called once one might be.
+	 */
+	bool AcquireToken();
+
+	bool IsFull() const
+	{
+		return cpusInUse >= maxRunning;
+	}
+
+	/* The number of job slots that running commands are using. */
+	size_t GetRunning() const
+	{
+		return cpusInUse;
+	}
+
+	size_t GetMaxRunning() const
+	{
+		return maxRunning;
+	}
+
+	/*
+	 * Change how many job slots may be used at once.  Lowering the limit
+	 * doesn't stop jobs that are already running.
+	 */
+	void SetMaxRunning(size_t max);
+
 	void Dispatch(int fd, short flags) override;
 	bool ScheduleJob();
 };
@@ -29,16 +29,51 @@
 #ifndef JOB_QUEUE_H
 #define JOB_QUEUE_H
 
-#include <deque>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <unordered_set>
+#include <vector>
 
 class Command;
 
+/*
+ * The commands that are ready to run.  The command with the longest
+ * critical path runs first; of those with the same estimate, the one with
+ * the most products waiting on it, and then the one submitted first.
+ */
 class JobQueue
 {
-	std::deque<Command*> queue;
+	struct Entry
+	{
+		uint64_t criticalPath;
+		uint32_t fanOut;
+		uint64_t order;
+		Command * command;
+
+		bool operator<(const Entry & rhs) const
+		{
+			if (criticalPath != rhs.criticalPath)
+				return criticalPath > rhs.criticalPath;
+			if (fanOut != rhs.fanOut)
+				return fanOut > rhs.fanOut;
+			return order < rhs.order;
+		}
+	};
+
+	std::set<Entry> queue;
+	uint64_t submitted;
+
+	/* The queued commands that LookAhead() has returned. */
+	std::unordered_set<Command*> seen;
 
 public:
-	JobQueue() = default;
+	JobQueue()
+	  : submitted(0)
+	{
+	}
+
 	JobQueue(const JobQueue &) = delete;
 	JobQueue(JobQueue &&) = delete;
 
@@ -46,7 +81,17 @@ public:
 	JobQueue & operator=(JobQueue &&) = delete;
 
 	Command * RemoveNext();
+
+	/* Remove the first command that canRun accepts. */
+	Command * RemoveNext(const std::function<bool(const Command &)> & canRun);
+
 	void Submit(Command *);
+
+	/*
+	 * Returns the commands among the next count to run that an earlier
+	 * call hasn't returned.
+	 */
+	std::vector<Command*> LookAhead(size_t count);
 };
 
 #endif
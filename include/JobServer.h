@@ -0,0 +1,129 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+#include "Event.h"
+#include "Path.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class EventLoop;
+
+/* The FIFO (in the state directory) of a jobserver started with -J fifo. */
+#define JOBSERVER_FIFO	"jobserver.fifo"
+
+/*
+ * The GNU make jobserver protocol, which shares job slots between factory
+ * and the makes (or cargos) that it runs.  Every free slot but one is a
+ * byte in a pipe or FIFO.  A process may always run one job; it reads a
+ * byte before it starts each job beyond that, and writes the byte back once
+ * the job is done.
+ *
+ * If factory is run by a make that has a jobserver, it takes its slots from
+ * that jobserver.  Otherwise, it creates its own.  Commands that ask for the
+ * jobserver find it in MAKEFLAGS.
+ */
+class JobServer : private Event
+{
+	int readFd;
+	int writeFd;
+
+	/* The FIFO that we created, if any. */
+	std::optional<Path> fifo;
+
+	/* "MAKEFLAGS=..." */
+	std::string makeflags;
+
+	/* The tokens that we have read, to be written back as they were. */
+	std::vector<char> tokens;
+
+	std::function<void()> listener;
+	bool waiting;
+	bool closed;
+
+	JobServer(EventLoop & loop, int r, int w);
+
+	static bool ParseAuth(std::string_view flags, std::string_view & auth);
+	static std::string StripJobFlags(std::string_view flags);
+
+	void Dispatch(int fd, short flags) override;
+
+public:
+	~JobServer();
+
+	JobServer(const JobServer &) = delete;
+	JobServer(JobServer &&) = delete;
+	JobServer & operator=(const JobServer &) = delete;
+	JobServer & operator=(JobServer &&) = delete;
+
+	/* Returns null if we weren't given a jobserver in MAKEFLAGS. */
+	static std::unique_ptr<JobServer> Connect(EventLoop & loop);
+
+	/*
+	 * Create a jobserver with the given number of slots, in a pipe whose
+	 * descriptors are inherited by the commands that use it, or in a
+	 * FIFO that they open.
+	 */
+	static std::unique_ptr<JobServer> Create(EventLoop & loop, size_t jobs,
+	    bool useFifo);
+
+	/*
+	 * Take a token, if one is free.  If not, the listener is called once
+	 * one might be.
+	 */
+	bool Acquire();
+	void Release();
+
+	size_t GetHeld() const
+	{
+		return tokens.size();
+	}
+
+	void SetListener(std::function<void()> && l)
+	{
+		listener = std::move(l);
+	}
+
+	const std::string & GetMakeflags() const
+	{
+		return makeflags;
+	}
+
+	/* Called before exec() in a child process that uses the jobserver. */
+	void Inherit() const;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef LOAD_MONITOR_H
+#define LOAD_MONITOR_H
+
+#include "Event.h"
+
+#include <cstddef>
+
+class EventLoop;
+class JobManager;
+
+/*
+ * Implements -j auto: periodically samples the load average and moves the
+ * job limit towards the number of CPUs that aren't busy with other work,
+ * within [minJobs, maxJobs].  The limit moves by at most one job per
+ * sample, and not at all for small differences, so that the lag in the
+ * load average doesn't make it oscillate.
+ */
+class LoadMonitor : private Event
+{
+	JobManager & jobManager;
+	const size_t minJobs;
+	const size_t maxJobs;
+	const size_t numCpus;
+
+	static size_t GetNumCpus();
+
+public:
+	LoadMonitor(EventLoop & loop, JobManager & jm, size_t min, size_t max);
+
+	LoadMonitor(const LoadMonitor &) = delete;
+	LoadMonitor(LoadMonitor &&) = delete;
+	LoadMonitor & operator=(const LoadMonitor &) = delete;
+	LoadMonitor & operator=(LoadMonitor &&) = delete;
+
+	/* Returns the number of CPUs. */
+	static size_t DefaultMaxJobs();
+
+	void Dispatch(int fd, short flags) override;
+};
+
+#endif
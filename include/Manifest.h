@@ -0,0 +1,88 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "CommandFactory.h"
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * A manifest lists commands compactly, for graphs that other tools generate.
+ * Reading one is much cheaper than calling factory.define_command() once per
+ * command.  Words are separated by blanks, and a line that ends in '$'
+ * continues on the next.  Lines starting with '#' are comments.
+ *
+ *	cflags = -O2 -pipe
+ *
+ *	rule cc
+ *		args = /usr/bin/cc $cflags -c -o $out $in
+ *		inputs = /usr/include
+ *		depfile = $out.d
+ *
+ *	build foo.o : cc foo.c
+ *		cflags = -O0
+ *
+ * A rule is a template shared by many commands.  Its args are required, and
+ * it may give the inputs that every command shares and any of the options
+ * to define_command().  Each build statement defines one command with the
+ * given products and inputs, and may set variables of its own, which take
+ * precedence over the variables at the top level.  $out and $in are the
+ * products and inputs of the build statement.
+ *
+ * The pool that a command names must already have been defined with
+ * factory.define_pool().
+ *
+ * A reference to a variable is $name or ${name}.  A reference that is a
+ * whole word expands to every word in the variable; in a longer word, the
+ * variable can have at most one word.  $$, "$ " and $: are a literal '$',
+ * ' ' and ':'.
+ */
+
+struct ManifestCommand
+{
+	std::vector<std::string> products;
+	std::vector<std::string> inputs;
+	std::vector<std::string> argList;
+	CommandOptions options;
+};
+
+typedef std::function<void(ManifestCommand &&)> ManifestCallback;
+
+/*
+ * Calls callback for every command in the manifest, in order.  Returns
+ * false, with a description in error, if the manifest is malformed.
+ */
+bool ParseManifest(std::string_view contents, const ManifestCallback & callback,
+    std::string & error);
+
+#endif
@@ -0,0 +1,80 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*
+ * Call func(i) for every i in [0, count), spread across threadsPerCpu threads
+ * per CPU.  func must be safe to call concurrently for different values of i.
+ * Returns once every call has completed.
+ *
+ * Work that mostly blocks on I/O (e.g. stat() on a network filesystem)
+ * benefits from more than one thread per CPU.
+ */
+template <typename F>
+void
+ParallelFor(size_t count, const F & func, unsigned threadsPerCpu = 1)
+{
+	size_t numThreads = std::min<size_t>(
+	    std::thread::hardware_concurrency() * threadsPerCpu, count);
+
+	if (numThreads <= 1) {
+		for (size_t i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&next, count, &func]()
+	{
+		size_t i;
+		while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+			func(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < numThreads; ++i) {
+		threads.emplace_back(worker);
+	}
+
+	/* The calling thread does its share of the work too. */
+	worker();
+
+	for (std::thread & thread : threads) {
+		thread.join();
+	}
+}
+
+#endif
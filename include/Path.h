@@ -77,6 +77,12 @@ public:
 	{
 	}
 
+	Path(std::string && p)
+	{
+		p.resize(StripTrailingSlashes(p).size());
+		path = std::move(p);
+	}
+
 	Path(const std::filesystem::path & p)
 	  : path(StripTrailingSlashes(p.c_str()))
 	{
@@ -122,6 +128,11 @@ public:
 		return path.filename();
 	}
 
+	Path stem() const
+	{
+		return path.stem();
+	}
+
 	bool is_relative() const
 	{
 		return path.is_relative();
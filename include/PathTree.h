@@ -0,0 +1,131 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef PATH_TREE_H
+#define PATH_TREE_H
+
+#include "Path.h"
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t PathId;
+
+/*
+ * Interns paths as a tree of components.  Each distinct path is identified
+ * by a small integer, and stores only its parent's id and its last
+ * component, whose text lives in an arena owned by the tree.  Finding the
+ * parent of a path is a single array access, and looking up a path hashes
+ * each component once without building any intermediate path objects.
+ *
+ * Components are split on '/' and empty components are dropped, so "a//b"
+ * and "a/b" are the same path, as with std::filesystem::path comparison.
+ */
+class PathTree
+{
+private:
+	struct Node
+	{
+		PathId parent;
+		std::string_view name;
+	};
+
+	struct ChildKey
+	{
+		PathId parent;
+		std::string_view name;
+
+		bool operator==(const ChildKey & rhs) const
+		{
+			return parent == rhs.parent && name == rhs.name;
+		}
+	};
+
+	struct ChildKeyHash
+	{
+		size_t operator()(const ChildKey & key) const;
+	};
+
+	std::vector<Node> nodes;
+	std::unordered_map<ChildKey, PathId, ChildKeyHash> children;
+
+	std::vector<std::unique_ptr<char[]>> arena;
+	size_t arenaUsed;
+
+	/* Whether a '/' goes between the path's parent and its name. */
+	bool NeedsSeparator(PathId id) const
+	{
+		PathId parent = nodes[id].parent;
+
+		return parent != ROOT && nodes[parent].name.back() != '/';
+	}
+
+	std::string_view Store(std::string_view name);
+	PathId Child(PathId parent, std::string_view name, bool create);
+	PathId Walk(std::string_view path, bool create);
+
+public:
+	/* The empty path, which is the parent of both "/" and relative paths. */
+	static constexpr PathId ROOT = 0;
+	static constexpr PathId INVALID = UINT32_MAX;
+
+	PathTree();
+
+	PathTree(const PathTree &) = delete;
+	PathTree(PathTree &&) = delete;
+	PathTree & operator=(const PathTree &) = delete;
+	PathTree & operator=(PathTree &&) = delete;
+
+	PathId Intern(std::string_view path)
+	{
+		return Walk(path, true);
+	}
+
+	/* Returns INVALID if the path has never been interned. */
+	PathId Find(std::string_view path) const
+	{
+		return const_cast<PathTree*>(this)->Walk(path, false);
+	}
+
+	PathId GetParent(PathId id) const
+	{
+		return nodes[id].parent;
+	}
+
+	Path GetPath(PathId id) const;
+
+	size_t Size() const
+	{
+		return nodes.size();
+	}
+};
+
+#endif
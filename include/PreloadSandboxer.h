@@ -44,7 +44,7 @@ struct SandboxMsg;
 class PreloadSandboxer : public Sandbox
 {
 private:
-	const Command & command;
+	Command & command;
 	JobSharedMemory shm;
 	std::vector<std::unique_ptr<MsgSocket>> sockets;
 	int exec_fd;
@@ -52,7 +52,7 @@ private:
 	void SendResponse(MsgSocket * sock, int error);
 
 public:
-	PreloadSandboxer(uint64_t jobId, const Command & c, const TempFile *msgSock);
+	PreloadSandboxer(uint64_t jobId, Command & c, const TempFile *msgSock);
 	~PreloadSandboxer();
 
 	virtual int GetExecFd() override;
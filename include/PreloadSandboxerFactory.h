@@ -52,7 +52,7 @@ public:
 	PreloadSandboxerFactory(TempFileManager &, EventLoop &, int maxJobs);
 	virtual ~PreloadSandboxerFactory();
 
-	virtual Sandbox & MakeSandbox(uint64_t jid, const Command &command) override;
+	virtual Sandbox & MakeSandbox(uint64_t jid, Command &command) override;
 	virtual void ReleaseSandbox(uint64_t jid) override;
 
 	PreloadSandboxer *RegisterSocket(uint64_t jobId, std::unique_ptr<MsgSocket>);
@@ -30,11 +30,12 @@
 #define PRODUCT_H
 
 #include "Path.h"
+#include "PathTree.h"
 #include "Command.h"
+#include "DepGraph.h"
+#include "FileStat.h"
 
 #include <cassert>
-#include <unordered_set>
-#include <vector>
 
 class JobQueue;
 class ProductManager;
@@ -42,22 +43,21 @@ class ProductManager;
 class Product
 {
 private:
-	Path path;
+	PathId pathId;
+	uint32_t graphIndex;
 	Command *command;
 	ProductManager & productManager;
 	bool needsBuild;
+	bool stale;
+	bool complete;
 	bool isDirectory;
+	bool isAggregate;
 	mutable bool statusValid;
-	mutable std::filesystem::file_status status;
-	mutable std::filesystem::file_time_type modTime;
+	mutable FileStat status;
 
-	std::unordered_set<Product*> dependencies;
-	std::vector<Product*> dependees;
-
-	void CacheStatus() const;
 
 public:
-	Product(const Path & p, ProductManager & mgr);
+	Product(PathId id, ProductManager & mgr, bool aggregate = false);
 
 	Product(const Product &) = delete;
 	Product(Product &&) = delete;
@@ -66,14 +66,27 @@ public:
 	Product &operator=(Product &&) = delete;
 
 	bool SetCommand(Command * j);
-	void AddDependency(Product *);
 
 	void BuildComplete(int status, uintmax_t jobId);
-	void DependencyComplete(Product *);
+	void DependencyComplete(Product *, bool changed);
+
+	/*
+	 * Tell our dependees that we are up to date.  changed is false if
+	 * our contents are the same as before the build, in which case
+	 * dependees that are waiting only on us don't need to run.
+	 */
+	void Complete(bool changed);
+
+	bool IsComplete() const
+	{
+		return complete;
+	}
 
-	const Path & GetPath() const
+	Path GetPath() const;
+
+	PathId GetPathId() const
 	{
-		return path;
+		return pathId;
 	}
 
 	Command * GetCommand()
@@ -81,24 +94,47 @@ public:
 		return command;
 	}
 
-	const std::vector<Product*> & GetDependees() const
+	uint32_t GetGraphIndex() const
 	{
-		return dependees;
+		return graphIndex;
 	}
 
-	const std::unordered_set<Product *> & GetInputs() const
+	void SetGraphIndex(uint32_t index)
 	{
-		return dependencies;
+		graphIndex = index;
 	}
 
+	/* These are empty until the dependency graph is frozen. */
+	DepGraph::Range GetDependees() const;
+	DepGraph::Range GetInputs() const;
+
 	void SetNeedsBuild();
 
+	/* Mark everything that depends on us as needing a build. */
+	void PropagateNeedsBuild();
+
 	bool NeedsBuild() const
 	{
 		return needsBuild;
 	}
 
-	bool IsReady();
+	/*
+	 * A product that needs a build might only be waiting to see whether
+	 * its inputs really change.  A stale product will be rebuilt no
+	 * matter what.
+	 */
+	void MarkStale();
+
+	bool IsStale() const
+	{
+		return stale;
+	}
+
+	/* True if none of our inputs are waiting to be built. */
+	bool IsReady() const;
+
+	/* False if this product is not needed by the requested targets. */
+	bool IsScheduled() const;
 	bool IsBuildable() const
 	{
 		return command != nullptr;
@@ -109,6 +145,15 @@ public:
 		return isDirectory;
 	}
 
+	/*
+	 * An aggregate stands in for the full contents of a directory.  It
+	 * has no command; it is complete as soon as all of its inputs are.
+	 */
+	bool IsAggregate() const
+	{
+		return isAggregate;
+	}
+
 	/*
 	 * Returns true if this was the first time the product was set as
 	 * a directory.
@@ -122,8 +167,20 @@ public:
 		return !wasDir;
 	}
 
-	const std::filesystem::file_status & GetStatus() const;
-	std::filesystem::file_time_type GetModifyTime() const;
+	/*
+	 * Stat the product and cache the result.  This may be called
+	 * concurrently for different products.
+	 */
+	void ProbeStatus() const;
+
+	bool StatusValid() const
+	{
+		return statusValid;
+	}
+
+	const FileStat & GetStatus() const;
+	void SetStatus(const FileStat & st);
+	int64_t GetModifyTime() const;
 
 };
 
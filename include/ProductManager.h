@@ -29,7 +29,11 @@
 #ifndef PRODUCT_MANAGER_H
 #define PRODUCT_MANAGER_H
 
+#include "AccessLog.h"
+#include "DepGraph.h"
+#include "DirSnapshot.h"
 #include "Path.h"
+#include "PathTree.h"
 #include "NamedTarget.h"
 
 #include <memory>
@@ -37,44 +41,125 @@
 #include <unordered_set>
 #include <vector>
 
+class Command;
+class DepsLog;
+class DigestDatabase;
+class JobHistory;
 class JobQueue;
 class Product;
+class StatCache;
 
 class ProductManager
 {
 private:
-	typedef std::unordered_map<Product*, std::vector<Product*>> DepMap;
-	typedef std::unordered_map<Path, std::unique_ptr<Product>> ProductMap;
+	typedef std::vector<std::unique_ptr<Product>> ProductMap;
+	typedef std::unordered_map<Product*, std::unique_ptr<Product>> AggregateMap;
+	typedef std::unordered_map<Path, Path> InputRootMap;
 	typedef std::unordered_map<std::string, NamedTarget> TargetMap;
+	typedef std::unordered_set<PathId> PathIdSet;
 
+	PathTree pathTree;
+
+	/* Indexed by PathId; paths that aren't products have no entry. */
 	ProductMap products;
 	JobQueue & jobQueue;
 
-	DepMap inputMap;
-	DepMap dependeeMap;
-	DepMap dirContentsMap;
+	DepGraph graph;
+
+	/* Products created inside of a directory by a command. */
+	std::vector<Product*> dirOutputs;
 	TargetMap targetMap;
-	std::vector<Product*> directories;
+	AggregateMap aggregates;
+	InputRootMap inputRoots;
+	std::unordered_map<const Product*, Path> rootFingerprints;
+	std::unordered_map<const Product*, uint64_t> restatDigests;
+	DirSnapshot dirSnapshot;
+	DigestDatabase *digests;
+	AccessLog *accessLog;
+	DepsLog *depsLog;
+	JobHistory *history;
+	StatCache *statCache;
+
+	/* Inputs that we only know about because a depfile listed them. */
+	std::unordered_set<const Product*> discoveredDeps;
+	std::unordered_map<const Command*, PathIdSet> depfileAccesses;
+
+	/*
+	 * What the access log says that each command read, interned so that
+	 * it can be matched against the files in a directory without building
+	 * their paths.  A null set means that the log has no record.  Filled
+	 * in as each build decides what is stale.
+	 */
+	std::unordered_map<const Command*, std::unique_ptr<PathIdSet>> loggedAccesses;
+
+	/*
+	 * Ephemeral products that were deleted after an earlier build.  They
+	 * stand in for what their dependees read when they were last built.
+	 */
+	std::unordered_set<const Product*> hollowProducts;
+
+	/* Hollow products that are rebuilt only because a dependee reads them. */
+	std::unordered_set<const Product*> recreatedProducts;
 
-	static bool FileExists(const Path & path);
+	/* The dependees of each ephemeral product that have yet to complete. */
+	std::unordered_map<const Product*, uint32_t> ephemeralConsumers;
+
+	bool FileExists(const Path & path) const;
 
 	void AddDependency(Product * product, Product * input);
+	void FreezeGraph();
+	void InitPending(const std::unordered_set<Product*> & products);
 
-	bool CheckNeedsBuild(Product * product, const Product * input);
+	bool InputChanged(const Path & product, const Product * input);
+	bool InputIsNewer(Product * product, const Product * input,
+	    const Path * record);
+	const PathIdSet * FindAccesses(Product * product);
+	bool AccessedInputIsNewer(Product * product, const Product * aggregate,
+	    const PathIdSet & accessed, const Path * record);
 	void CheckNeedsBuild(Product * product);
 
-	Product * FindProduct(const Path &);
-	Product * MakeProduct(const Path &);
+	Product * FindProduct(PathId id);
+	Product * GetProduct(PathId id, bool makeParent);
+	Product * MakeProduct(PathId id);
+	void ProbeProducts(const std::unordered_set<Product*> & set);
 
 	void SubmitProductJob(Product *product);
+	bool CanCutOff(Product *product);
+	void CutOff(Product *product);
+	void RecordRestatDigests(Command *command);
+	void GetRecordedInputs(Product *product,
+	    const std::vector<Product*> & files, std::vector<Path> & inputs);
+	void BuildStarting(Command *command);
 
 	bool IsBlocked(Product *product);
 	void ReportCycle(Product * product);
+	void CheckCycles(const std::vector<Product*> & roots);
+	void PrintCycle(const std::vector<Product*> & component);
 
-	void CalcDeps();
-	void CollectParentInputs(Product *product);
-	void CollectInputTree(std::unordered_set<Product*> & set, Product *p);
-	void AddDirProducts(Product *dir, std::unordered_set<Product*> & dirContents);
+	std::vector<Product*> CalcDeps(const std::unordered_set<Product*> & set);
+	Product * MakeAggregate(Product *dir);
+	const Path * FindInputRoot(const Path & path) const;
+	void UpdateAggregateStatus();
+	void CollectFileInputs(Product *product, std::vector<Product*> & files);
+	void AddDirOutputs(const std::unordered_set<Product*> & dirs);
+	void AddParentInputs();
+	void AddLoggedDeps();
+	bool IsDiscoveredSource(const Product *product) const;
+	void IngestDepfile(Command *command);
+	void CheckParentExists(Product *product);
+	void CollectInputs(std::unordered_set<Product*> & set,
+	    const std::vector<Product*> & roots);
+	void RemoveEphemeral(Product * product);
+	void CollectInputTree(std::unordered_set<Product*> & set,
+	    const std::vector<Product*> & roots);
+	void PrefetchDigests(const std::unordered_set<Product*> & products);
+	bool IsEphemeral(Product * product);
+	bool MakeHollow(Product * product);
+	void FindHollowProducts(const std::unordered_set<Product*> & products);
+	void RecreateHollowInputs(const std::unordered_set<Product*> & products);
+	void TrackEphemeral(const std::unordered_set<Product*> & products,
+	    const std::vector<Product*> & roots);
+	void PrioritizeCommands(const std::unordered_set<Product*> & products);
 
 public:
 	ProductManager(JobQueue &);
@@ -84,15 +169,118 @@ public:
 	ProductManager &operator=(const ProductManager &) = delete;
 	ProductManager &operator=(ProductManager &&) = delete;
 
+	/*
+	 * Decide staleness by comparing the contents of inputs against the
+	 * recorded contents at the time of the last successful build, rather
+	 * than by modification time.
+	 */
+	void SetDigestDatabase(DigestDatabase * db)
+	{
+		digests = db;
+	}
+
+	/*
+	 * Remember which files each command read, and only consider those
+	 * files when a command has a directory as an input.
+	 */
+	void SetAccessLog(AccessLog * log)
+	{
+		accessLog = log;
+	}
+
+	/*
+	 * Use the dependencies that commands reported in their depfiles
+	 * in addition to their declared inputs.
+	 */
+	void SetDepsLog(DepsLog * log)
+	{
+		depsLog = log;
+	}
+
+	/*
+	 * Run the commands on the longest chains to the targets first, going
+	 * by how long they took to run before.
+	 */
+	void SetJobHistory(JobHistory * h)
+	{
+		history = h;
+	}
+
+	/*
+	 * Take the status of source files from the cache rather than probing
+	 * them, and record the ones that weren't there.
+	 */
+	void SetStatCache(StatCache * cache)
+	{
+		statCache = cache;
+	}
+
+	/*
+	 * Declare that nothing under root changes unless the modification
+	 * time of fingerprint does, so that directory inputs under root don't
+	 * need to be enumerated.  fingerprint may be root itself.
+	 */
+	void AddInputRoot(const Path & root, const Path & fingerprint);
+
+	const PathTree & GetPathTree() const
+	{
+		return pathTree;
+	}
+
+	DepGraph & GetGraph()
+	{
+		return graph;
+	}
+
 	Product * GetProduct(const Path &, bool makeParent = true);
+
+	/* Returns nullptr if nothing has referred to the path. */
+	Product * FindProduct(const Path &);
 	void SetInputs(Product * product, std::vector<Product*> inputs);
 
 	void AddToTarget(std::string_view name, Product *p);
 
+	/* Returns nullptr if nothing has been added to the target. */
+	const NamedTarget * FindTarget(const std::string & name) const;
+
+	/*
+	 * Before the graph is frozen, find the paths that the targets need but
+	 * that no command makes yet.  inputs gets the ones that commands
+	 * declared, and parents the directories that products are made in.
+	 */
+	void FindUnmadeInputs(const std::unordered_set<std::string_view> &targets,
+	    std::vector<Path> & inputs, std::vector<Path> & parents);
+
 	void CheckBlockedCommands();
 	void SubmitLeafJobs(const std::unordered_set<std::string_view> &targets);
 
 	void ProductReady(Product *);
+	void ProductBuilt(Product *);
+
+	/*
+	 * Called when a product is complete, to delete the ephemeral inputs
+	 * that nothing else is waiting to read.
+	 */
+	void InputsConsumed(Product *);
+
+	/*
+	 * For a product built before the graph was frozen, given the files
+	 * that its command declared as inputs.
+	 */
+	void ProductBuilt(Product *, const std::vector<Product*> & files);
+
+	/*
+	 * Called just before the command making a product starts, given the
+	 * files that ProductBuilt() will be given, so that inputs changed
+	 * while it runs can be left out of its build record.
+	 */
+	void BuildStarting(Product *, const std::vector<Product*> & files);
+
+	/*
+	 * Returns false if a product of a restat command is the same as it
+	 * was before the command ran.
+	 */
+	bool ProductChanged(Product *);
 };
 
 #endif
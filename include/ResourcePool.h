@@ -0,0 +1,84 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef RESOURCE_POOL_H
+#define RESOURCE_POOL_H
+
+#include <cstdint>
+#include <string>
+
+/*
+ * A named class of commands, of which at most depth may run at once, no
+ * matter how many jobs are allowed in total.
+ */
+class ResourcePool
+{
+	std::string name;
+	uint32_t depth;
+	uint32_t running;
+
+public:
+	ResourcePool(std::string n, uint32_t d)
+	  : name(std::move(n)),
+	    depth(d),
+	    running(0)
+	{
+	}
+
+	ResourcePool(const ResourcePool &) = delete;
+	ResourcePool(ResourcePool &&) = delete;
+	ResourcePool & operator=(const ResourcePool &) = delete;
+	ResourcePool & operator=(ResourcePool &&) = delete;
+
+	const std::string & GetName() const
+	{
+		return name;
+	}
+
+	uint32_t GetDepth() const
+	{
+		return depth;
+	}
+
+	bool IsFull() const
+	{
+		return running >= depth;
+	}
+
+	void Acquire()
+	{
+		running++;
+	}
+
+	void Release()
+	{
+		running--;
+	}
+};
+
+#endif
@@ -40,7 +40,7 @@ class SandboxFactory
 public:
 	virtual ~SandboxFactory() = default;
 
-	virtual Sandbox& MakeSandbox(uint64_t jid, const Command &command) = 0;
+	virtual Sandbox& MakeSandbox(uint64_t jid, Command &command) = 0;
 	virtual void ReleaseSandbox(uint64_t jid) = 0;
 };
 
@@ -0,0 +1,81 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef STAT_CACHE_H
+#define STAT_CACHE_H
+
+#include "FileStat.h"
+#include "Path.h"
+
+#include <unordered_map>
+#include <vector>
+
+/*
+ * The status of source files, kept by the daemon between builds.  An entry
+ * is only valid for as long as something is watching the file for changes;
+ * the watcher must call Invalidate() as soon as the file changes.
+ *
+ * Builds look up files here before probing them, and record the files that
+ * they had to probe (the misses) so that the daemon can start watching them.
+ */
+class StatCache
+{
+	std::unordered_map<Path, FileStat> entries;
+	std::vector<Path> misses;
+
+public:
+	StatCache() = default;
+
+	StatCache(const StatCache &) = delete;
+	StatCache(StatCache &&) = delete;
+	StatCache & operator=(const StatCache &) = delete;
+	StatCache & operator=(StatCache &&) = delete;
+
+	/* Returns false if path is not in the cache. */
+	bool Lookup(const Path & path, FileStat & status) const;
+
+	void Add(const Path & path, const FileStat & status);
+	void Invalidate(const Path & path);
+
+	void RecordMiss(const Path & path)
+	{
+		misses.push_back(path);
+	}
+
+	const std::vector<Path> & GetMisses() const
+	{
+		return misses;
+	}
+
+	size_t Size() const
+	{
+		return entries.size();
+	}
+};
+
+#endif
@@ -0,0 +1,148 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef STATE_FILE_H
+#define STATE_FILE_H
+
+#include "MappedFile.h"
+#include "Path.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Directory (relative to the directory that factory was run from) that holds
+ * all state that factory persists between builds.
+ */
+#define FACTORY_STATE_DIR ".factory"
+
+Path GetStateFilePath(std::string_view name);
+
+/*
+ * State files are simple binary files in host byte order.  Every file starts
+ * with a magic number and a version; a file with any other version is
+ * ignored, so any change to a file's layout must be accompanied by a version
+ * bump.
+ */
+class StateFileWriter
+{
+	std::string buf;
+
+public:
+	StateFileWriter(uint32_t magic, uint32_t version);
+
+	StateFileWriter(const StateFileWriter &) = delete;
+	StateFileWriter(StateFileWriter &&) = delete;
+	StateFileWriter & operator=(const StateFileWriter &) = delete;
+	StateFileWriter & operator=(StateFileWriter &&) = delete;
+
+	template <typename T>
+	void Write(T val)
+	{
+		static_assert(std::is_integral_v<T>, "Only integers may be written");
+		buf.append(reinterpret_cast<const char *>(&val), sizeof(val));
+	}
+
+	void WriteString(std::string_view str);
+	void WriteStringList(const std::vector<std::string> & list);
+
+	/*
+	 * Atomically replace the file at path with the contents written so
+	 * far.  Returns false (with errno set) on failure.
+	 */
+	bool Commit(const Path & path);
+};
+
+class StateFileReader
+{
+	MappedFile file;
+	std::string_view data;
+	size_t pos;
+	bool failed;
+
+	bool Consume(size_t len)
+	{
+		if (failed || data.size() - pos < len) {
+			failed = true;
+			return false;
+		}
+		return true;
+	}
+
+public:
+	StateFileReader();
+
+	StateFileReader(const StateFileReader &) = delete;
+	StateFileReader(StateFileReader &&) = delete;
+	StateFileReader & operator=(const StateFileReader &) = delete;
+	StateFileReader & operator=(StateFileReader &&) = delete;
+
+	/*
+	 * Returns false if the file doesn't exist or if it was written with
+	 * a different magic number or version.
+	 */
+	bool Open(const Path & path, uint32_t magic, uint32_t version);
+
+	/*
+	 * Reads past the end of the file return 0 or an empty string and
+	 * mark the reader as failed.  Callers are expected to check Failed()
+	 * once they are done with the file rather than after every read.
+	 */
+	template <typename T>
+	T Read()
+	{
+		static_assert(std::is_integral_v<T>, "Only integers may be read");
+		T val = 0;
+
+		if (Consume(sizeof(val))) {
+			memcpy(&val, data.data() + pos, sizeof(val));
+			pos += sizeof(val);
+		}
+		return val;
+	}
+
+	/* The returned string_view points directly into the mapped file. */
+	std::string_view ReadString();
+	std::vector<std::string> ReadStringList();
+
+	bool AtEnd() const
+	{
+		return pos == data.size();
+	}
+
+	bool Failed() const
+	{
+		return failed;
+	}
+};
+
+#endif
@@ -79,6 +79,12 @@ private:
 		return std::is_invocable_v<F, IndexType, int64_t>;
 	}
 
+	template <typename F, typename IndexType>
+	static constexpr bool takes_bool_value()
+	{
+		return std::is_invocable_v<F, IndexType, bool>;
+	}
+
 	template <typename F, typename IndexType>
 	static constexpr bool takes_str_value()
 	{
@@ -101,6 +107,7 @@ private:
 	static constexpr bool callback_is_invocable()
 	{
 		return takes_int_value<F, IndexType>() ||
+		    takes_bool_value<F, IndexType>() ||
 		    takes_str_value<F, IndexType>() ||
 		    takes_table_value<F, IndexType>() ||
 		    takes_func_value<F, IndexType>();
@@ -109,6 +116,9 @@ private:
 	template <typename F, typename IndexType>
 	void InvokeIntCallback(const F & func, const NamedValue & subvalue, IndexType index, int stackPos);
 
+	template <typename F, typename IndexType>
+	void InvokeBoolCallback(const F & func, const NamedValue & subvalue, IndexType index, int stackPos);
+
 	template <typename F, typename IndexType>
 	void InvokeStrCallback(const F & func, const NamedValue & subvalue, IndexType index, int stackPos);
 
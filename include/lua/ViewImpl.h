@@ -46,6 +46,16 @@ View::InvokeIntCallback(const F & func, const NamedValue & subvalue, IndexType i
 		throw InterpreterException("Did not expect an int in %s", subvalue.ToString().c_str());
 }
 
+template <typename F, typename IndexType>
+void
+View::InvokeBoolCallback(const F & func, const NamedValue & subvalue, IndexType index, int stackPos)
+{
+	if constexpr (takes_bool_value<F, IndexType>())
+		func(index, static_cast<bool>(lua_toboolean(lua, stackPos)));
+	else
+		throw InterpreterException("Did not expect a boolean in %s", subvalue.ToString().c_str());
+}
+
 template <typename F, typename IndexType>
 void
 View::InvokeStrCallback(const F & func, const NamedValue & subvalue, IndexType index, int stackPos)
@@ -85,6 +95,8 @@ View::InvokeCallback(const NamedValue & value, const F & func, IndexType index,
 	NamedValue subvalue(value, index, stackPos);
 	if (lua_isinteger(lua, stackPos)) {
 		InvokeIntCallback(func, subvalue, index, stackPos);
+	} else if (lua_isboolean(lua, stackPos)) {
+		InvokeBoolCallback(func, subvalue, index, stackPos);
 	} else if (lua_isstring(lua, stackPos)) {
 		InvokeStrCallback(func, subvalue, index, stackPos);
 	} else if (lua_istable(lua, stackPos)) {
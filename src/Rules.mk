@@ -3,6 +3,7 @@ SUBDIRS := \
 	buildkernel \
 	capsicum \
 	config \
+	daemon \
 	ebpf \
 	eventloop \
 	ingest \
@@ -40,7 +40,7 @@ CapsicumSandboxFactory::~CapsicumSandboxFactory()
 }
 
 Sandbox&
-CapsicumSandboxFactory::MakeSandbox(uint64_t jid, const Command &c)
+CapsicumSandboxFactory::MakeSandbox(uint64_t jid, Command &c)
 {
 
 	auto [it, success] = sandboxMap.emplace(jid, std::make_unique<CapsicumSandbox>(
@@ -0,0 +1,395 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "BuildDaemon.h"
+
+#include "DaemonMsg.h"
+#include "EventLoop.h"
+#include "FileStat.h"
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cassert>
+
+#define DAEMON_LISTEN_BACKLOG	16
+
+BuildDaemon::BuildDaemon(EventLoop & loop, Path sock, DaemonBuilder & b)
+  : builder(b),
+    sockPath(std::move(sock)),
+    listenFd(-1),
+    watcher(loop, [this](const Path & path) { FileChanged(path); }),
+    graphLoaded(false)
+{
+	struct rlimit rl;
+
+	/* Every watched file needs a descriptor, so allow as many as we can. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	Listen();
+	loop.RegisterListenSocket(this, listenFd);
+
+	LoadGraph();
+}
+
+BuildDaemon::~BuildDaemon()
+{
+	close(listenFd);
+	unlink(sockPath.c_str());
+}
+
+void
+BuildDaemon::Listen()
+{
+	struct sockaddr_un addr;
+	int probe;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlcpy(addr.sun_path, sockPath.c_str(), sizeof(addr.sun_path)) >=
+	    sizeof(addr.sun_path))
+		errx(1, "Daemon socket path '%s' is too long", sockPath.c_str());
+
+	Path dir = sockPath.parent_path();
+	if (!dir.empty() && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+		err(1, "Could not create directory '%s'", dir.c_str());
+
+	/*
+	 * A socket that nobody accepts connections on was left behind by a
+	 * daemon that has exited, and can be replaced.
+	 */
+	probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (probe < 0)
+		err(1, "socket() failed");
+	if (connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0)
+		errx(1, "A factory daemon is already listening on '%s'", sockPath.c_str());
+	close(probe);
+	unlink(sockPath.c_str());
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenFd < 0)
+		err(1, "socket() failed");
+
+	if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+		err(1, "Could not bind to '%s'", sockPath.c_str());
+
+	if (listen(listenFd, DAEMON_LISTEN_BACKLOG) != 0)
+		err(1, "listen() failed");
+}
+
+void
+BuildDaemon::FileChanged(const Path & path)
+{
+
+	statCache.Invalidate(path);
+
+	if (scripts.count(path) != 0 && graphLoaded) {
+		fprintf(stderr, "'%s' changed; the build scripts will be re-evaluated\n",
+		    path.c_str());
+		builder.DropGraph();
+		graphLoaded = false;
+	}
+}
+
+void
+BuildDaemon::LoadGraph()
+{
+	std::vector<Path> paths;
+
+	scripts.clear();
+	if (!builder.LoadGraph(paths))
+		return;
+
+	for (const Path & path : paths) {
+		if (!watcher.Watch(path)) {
+			warn("Could not watch '%s'", path.c_str());
+			builder.DropGraph();
+			return;
+		}
+		scripts.insert(path);
+	}
+
+	/* A script might have changed before we started watching it. */
+	if (!builder.GraphIsCurrent()) {
+		builder.DropGraph();
+		return;
+	}
+
+	graphLoaded = true;
+}
+
+/*
+ * Send the paths that the build had to probe back to the daemon, as
+ * NUL-terminated strings.
+ */
+void
+BuildDaemon::ReportMisses(int fd)
+{
+	std::string buf;
+
+	for (const Path & path : statCache.GetMisses()) {
+		buf.append(path.string());
+		buf.push_back('\0');
+	}
+
+	const char *next = buf.data();
+	size_t left = buf.size();
+	while (left > 0) {
+		ssize_t bytes = write(fd, next, left);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		next += bytes;
+		left -= bytes;
+	}
+}
+
+void
+BuildDaemon::WatchMisses(int fd)
+{
+	std::string buf;
+	char chunk[4096];
+
+	while (true) {
+		ssize_t bytes = read(fd, chunk, sizeof(chunk));
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("Could not read probed files from build");
+			break;
+		}
+
+		if (bytes == 0)
+			break;
+
+		buf.append(chunk, bytes);
+	}
+
+	size_t start = 0;
+	size_t end;
+	while ((end = buf.find('\0', start)) != std::string::npos) {
+		Path path(buf.substr(start, end - start));
+		start = end + 1;
+
+		/* Watch before probing, so that no change can slip in between. */
+		if (!watcher.Watch(path))
+			continue;
+
+		FileStat status = FileStat::Probe(path);
+		if (status.exists)
+			statCache.Add(path, status);
+	}
+}
+
+int
+BuildDaemon::RunBuild(const std::vector<std::string> & targets, int outFd, int errFd)
+{
+	int report[2];
+	int status;
+	pid_t child;
+
+	if (pipe2(report, O_CLOEXEC) != 0) {
+		warn("pipe2() failed");
+		return 1;
+	}
+
+	/* Don't let the child flush anything that we buffered. */
+	fflush(stdout);
+	fflush(stderr);
+
+	child = fork();
+	if (child < 0) {
+		warn("fork() failed");
+		close(report[0]);
+		close(report[1]);
+		return 1;
+	}
+
+	if (child == 0) {
+		close(report[0]);
+
+		if (dup2(outFd, STDOUT_FILENO) < 0 || dup2(errFd, STDERR_FILENO) < 0)
+			err(1, "Could not redirect output to the client");
+
+		status = builder.Build(targets, statCache);
+		ReportMisses(report[1]);
+		exit(status);
+	}
+
+	close(report[1]);
+	WatchMisses(report[0]);
+	close(report[0]);
+
+	while (waitpid(child, &status, 0) < 0) {
+		if (errno != EINTR) {
+			warn("waitpid() failed");
+			return 1;
+		}
+	}
+
+	/*
+	 * Without a graph, the build evaluated the scripts, and cached the
+	 * result for us to pick up.
+	 */
+	if (!graphLoaded)
+		LoadGraph();
+
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+/*
+ * Returns false if the request is malformed, after closing any descriptors
+ * that came with it.
+ */
+bool
+BuildDaemon::ReadRequest(int sock, std::vector<std::string> & targets, int fds[2])
+{
+	DaemonRequest req;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(2 * sizeof(int))];
+	} control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	bool haveFds;
+
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t bytes = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+
+	haveFds = false;
+	cmsg = bytes > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS) {
+		if (cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+			memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+			haveFds = true;
+		} else if (cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+			close(*reinterpret_cast<int *>(CMSG_DATA(cmsg)));
+		}
+	}
+
+	if (!haveFds)
+		return false;
+
+	std::string buf;
+	if (bytes == sizeof(req) && req.magic == DAEMON_MSG_MAGIC &&
+	    req.targetsLen <= DAEMON_MAX_TARGETS_LEN) {
+		buf.resize(req.targetsLen);
+		if (req.targetsLen != 0)
+			bytes = recv(sock, buf.data(), buf.size(), MSG_WAITALL);
+		else
+			bytes = 0;
+	} else {
+		bytes = -1;
+	}
+
+	if (bytes != static_cast<ssize_t>(buf.size()) ||
+	    (!buf.empty() && buf.back() != '\0')) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	for (size_t start = 0; start < buf.size(); ) {
+		size_t end = buf.find('\0', start);
+		targets.emplace_back(buf, start, end - start);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+void
+BuildDaemon::HandleRequest(int sock)
+{
+	std::vector<std::string> targets;
+	DaemonResponse resp;
+	int fds[2];
+
+	if (!ReadRequest(sock, targets, fds)) {
+		warnx("Ignoring malformed request");
+		return;
+	}
+
+	/* Pick up anything that changed just before the request. */
+	watcher.Poll();
+	if (!graphLoaded)
+		LoadGraph();
+
+	resp.status = RunBuild(targets, fds[0], fds[1]);
+	close(fds[0]);
+	close(fds[1]);
+
+	if (send(sock, &resp, sizeof(resp), MSG_NOSIGNAL) != sizeof(resp))
+		warn("Could not send the build status to the client");
+}
+
+void
+BuildDaemon::Dispatch(int fd, short flags)
+{
+	assert (fd == listenFd);
+
+	int sock = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+	if (sock < 0) {
+		if (errno != EINTR && errno != ECONNABORTED)
+			warn("accept() failed");
+		return;
+	}
+
+	HandleRequest(sock);
+	close(sock);
+}
@@ -0,0 +1,6 @@
+
+LIB :=	daemon
+
+SRCS := \
+	BuildDaemon.cpp \
+	DaemonClient.cpp \
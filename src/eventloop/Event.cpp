@@ -42,7 +42,19 @@ Event::~Event()
 	event_free(ev);
 }
 
+void
+Event::Enable()
+{
+
+	event_add(ev, NULL);
+}
 
+void
+Event::Disable()
+{
+
+	event_del(ev);
+}
 
 void
 Event::SetEvent(struct event *ev)
@@ -85,6 +85,31 @@ EventLoop::RegisterSocket(Event *event, int fd)
 	event_add(ev, NULL);
 }
 
+void
+EventLoop::RegisterPipe(Event *event, int fd)
+{
+	struct event *ev;
+
+	ev = event_new(ev_base, fd, EV_READ | EV_PERSIST, EventCallback, event);
+	if (ev == NULL)
+		throw std::runtime_error("event_new() failed");
+
+	event->SetEvent(ev);
+}
+
+void
+EventLoop::RegisterTimer(Event *event, const struct timeval & interval)
+{
+	struct event *ev;
+
+	ev = event_new(ev_base, -1, EV_PERSIST, EventCallback, event);
+	if (ev == NULL)
+		throw std::runtime_error("event_new() failed");
+
+	event->SetEvent(ev);
+	event_add(ev, &interval);
+}
+
 void
 EventLoop::EventCallback(evutil_socket_t fd, short flags, void *arg)
 {
@@ -99,6 +124,12 @@ EventLoop::Run()
 	event_base_dispatch(ev_base);
 }
 
+void
+EventLoop::Poll()
+{
+	event_base_loop(ev_base, EVLOOP_NONBLOCK);
+}
+
 void
 EventLoop::SignalExit()
 {
@@ -0,0 +1,134 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "FileWatcher.h"
+
+#include "EventLoop.h"
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <iterator>
+
+#define WATCH_EVENTS	(NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | \
+			 NOTE_ATTRIB | NOTE_LINK | NOTE_RENAME | NOTE_REVOKE)
+
+FileWatcher::FileWatcher(EventLoop & loop, Callback cb)
+  : callback(std::move(cb))
+{
+	kq = kqueue();
+	if (kq < 0)
+		err(1, "kqueue() failed");
+
+	loop.RegisterListenSocket(this, kq);
+}
+
+FileWatcher::~FileWatcher()
+{
+	for (auto & [fd, path] : watches) {
+		close(fd);
+	}
+
+	close(kq);
+}
+
+bool
+FileWatcher::Watch(const Path & path)
+{
+	struct kevent kev;
+	int fd, error;
+
+	if (watched.count(path) != 0)
+		return true;
+
+	fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	EV_SET(&kev, fd, EVFILT_VNODE, EV_ADD | EV_ONESHOT, WATCH_EVENTS, 0, NULL);
+	error = kevent(kq, &kev, 1, NULL, 0, NULL);
+	if (error != 0) {
+		close(fd);
+		return false;
+	}
+
+	watches.emplace(fd, path);
+	watched.insert(path);
+	return true;
+}
+
+void
+FileWatcher::Poll()
+{
+	struct kevent events[64];
+	struct timespec zero = {0, 0};
+	int count;
+
+	while (true) {
+		count = kevent(kq, NULL, 0, events, std::size(events), &zero);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "kevent() failed");
+		}
+
+		if (count == 0)
+			break;
+
+		for (int i = 0; i < count; ++i) {
+			int fd = static_cast<int>(events[i].ident);
+
+			auto it = watches.find(fd);
+			assert (it != watches.end());
+
+			Path path(std::move(it->second));
+			watches.erase(it);
+			watched.erase(path);
+
+			/* Closing the file also removes the event. */
+			close(fd);
+
+			callback(path);
+		}
+	}
+}
+
+void
+FileWatcher::Dispatch(int fd, short flags)
+{
+	assert (fd == kq);
+
+	Poll();
+}
@@ -4,3 +4,4 @@ LIB :=	eventloop
 SRCS := \
 	Event.cpp \
 	EventLoop.cpp \
+	FileWatcher.cpp \
@@ -44,6 +44,7 @@
 #include "lua/View.h"
 
 #include <cassert>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
@@ -55,9 +56,12 @@ const char Interpreter::INTERPRETER_REGISTRY_ENTRY = 0;
 const struct luaL_Reg Interpreter::factoryModule [] = {
 	{"add_definitions", FuncImplWrapper<&Interpreter::AddDefinitions>},
 	{ "define_command", FuncImplWrapper<&Interpreter::DefineCommand>},
+	{"define_input_root", FuncImplWrapper<&Interpreter::DefineInputRoot>},
+	{    "define_pool", FuncImplWrapper<&Interpreter::DefinePool>},
 	{  "evaluate_vars", FuncImplWrapper<&Interpreter::EvaluateVars>},
 	{ "include_script", FuncImplWrapper<&Interpreter::Include<IncludeFile::Type::SCRIPT>>},
 	{ "include_config", FuncImplWrapper<&Interpreter::Include<IncludeFile::Type::CONFIG>>},
+	{ "include_manifest", FuncImplWrapper<&Interpreter::Include<IncludeFile::Type::MANIFEST>>},
 	{       "realpath", FuncImplWrapper<&Interpreter::Realpath>},
 	{nullptr, nullptr}
 };
@@ -115,6 +119,76 @@ Interpreter::RunFile(const std::string & path, const ConfigNode & config)
 	}
 }
 
+void
+Interpreter::SetConfiguration(const std::string & name, const ConfigNode & params)
+{
+	lua_State *lua = luaState.get();
+
+	if (!std::holds_alternative<ConfigPairMap>(params.GetValue()))
+		errx(1, "Configuration '%s' must be an object", name.c_str());
+
+	lua_getglobal(lua, "factory");
+	PushConfig(params);
+	lua_pushstring(lua, name.c_str());
+	lua_setfield(lua, -2, "name");
+	lua_setfield(lua, -2, "configuration");
+	lua_pop(lua, 1);
+}
+
+void
+Interpreter::PushConfig(const ConfigNode & node)
+{
+
+	std::visit(ConfigVisitor(*this), node.GetValue());
+}
+
+void
+Interpreter::ConfigVisitor::operator()(int64_t value) const
+{
+
+	lua_pushinteger(interp.luaState.get(), value);
+}
+
+void
+Interpreter::ConfigVisitor::operator()(bool value) const
+{
+
+	lua_pushboolean(interp.luaState.get(), value);
+}
+
+void
+Interpreter::ConfigVisitor::operator()(const std::string & value) const
+{
+
+	lua_pushstring(interp.luaState.get(), value.c_str());
+}
+
+void
+Interpreter::ConfigVisitor::operator()(const ConfigNodeList & list) const
+{
+	lua_State *lua = interp.luaState.get();
+
+	lua_createtable(lua, list.size(), 0);
+	for (size_t i = 0; i < list.size(); ++i) {
+		interp.PushConfig(*list.at(i));
+
+		// +1 because lua arrays are 1-based
+		lua_seti(lua, -2, i + 1);
+	}
+}
+
+void
+Interpreter::ConfigVisitor::operator()(const ConfigPairMap & map) const
+{
+	lua_State *lua = interp.luaState.get();
+
+	lua_createtable(lua, 0, map.size());
+	for (const auto & [name, node] : map) {
+		interp.PushConfig(*node);
+		lua_setfield(lua, -2, name.c_str());
+	}
+}
+
 std::optional<IncludeFile>
 Interpreter::GetNextInclude()
 {
@@ -239,6 +313,27 @@ Interpreter::StringField(T & str)
 		};
 }
 
+template <typename T>
+auto
+Interpreter::IntField(T & value)
+{
+	return [&value](const std::string & name, int64_t i)
+		{
+			if (i < 0 || static_cast<uint64_t>(i) > std::numeric_limits<T>::max())
+				throw InterpreterException("%s is out of range", name.c_str());
+			value = i;
+		};
+}
+
+auto
+Interpreter::BoolField(bool & value)
+{
+	return [&value](const std::string & name, bool b)
+		{
+			value = b;
+		};
+}
+
 auto
 Interpreter::StringListField(std::vector<std::string> & list)
 {
@@ -319,6 +414,14 @@ Interpreter::GetCommandOptions(Lua::Table &table)
 		Lua::FieldSpec("stdout", StringField(opt.stdout)).Optional(true),
 		Lua::FieldSpec("statdirs", StringListField(opt.statdirs)).Optional(true),
 		Lua::FieldSpec("order_deps", StringListField(opt.orderDeps)).Optional(true),
+		Lua::FieldSpec("restat", BoolField(opt.restat)).Optional(true),
+		Lua::FieldSpec("ephemeral", BoolField(opt.ephemeral)).Optional(true),
+		Lua::FieldSpec("stream", BoolField(opt.stream)).Optional(true),
+		Lua::FieldSpec("jobserver", BoolField(opt.jobserver)).Optional(true),
+		Lua::FieldSpec("depfile", StringField(opt.depfile)).Optional(true),
+		Lua::FieldSpec("pool", StringField(opt.pool)).Optional(true),
+		Lua::FieldSpec("cpus", IntField(opt.cpus)).Optional(true),
+		Lua::FieldSpec("memory", IntField(opt.memory)).Optional(true),
 		Lua::FieldSpec("targets", StringListField(opt.targetList)).Optional(true)
 	};
 
@@ -358,6 +461,61 @@ Interpreter::DefineCommand()
 	return 0;
 }
 
+// factory.define_input_root(paths, options)
+int
+Interpreter::DefineInputRoot()
+{
+	Lua::View lua(luaState);
+
+	Lua::Parameter pathsArg("factory.define_input_root", "paths", 1);
+	Lua::Parameter optionsArg("factory.define_input_root", "options", 2);
+
+	auto paths = GetStringList(lua, pathsArg);
+
+	std::optional<Path> stamp;
+	Lua::ValueParser parser {
+		Lua::FieldSpec("stamp", StringField(stamp)).Optional(true)
+	};
+
+	auto optTable = lua.GetTable(optionsArg);
+	optTable.ParseMap(parser);
+
+	for (const std::string & path : paths) {
+		commandFactory.AddInputRoot(path, stamp);
+	}
+
+	return 0;
+}
+
+// factory.define_pool(name, options)
+int
+Interpreter::DefinePool()
+{
+	Lua::View lua(luaState);
+
+	Lua::Parameter nameArg("factory.define_pool", "name", 1);
+	Lua::Parameter optionsArg("factory.define_pool", "options", 2);
+
+	std::string name(lua.GetString(nameArg));
+
+	uint32_t depth = 0;
+	Lua::ValueParser parser {
+		Lua::FieldSpec("depth", IntField(depth))
+	};
+
+	auto optTable = lua.GetTable(optionsArg);
+	optTable.ParseMap(parser);
+
+	if (depth == 0) {
+		throw InterpreterException("In %s: depth must be at least 1",
+		    optionsArg.ToString().c_str());
+	}
+
+	commandFactory.AddPool(name, depth);
+
+	return 0;
+}
+
 std::unique_ptr<ConfigNode>
 Interpreter::SerializeConfig(Lua::Table & config)
 {
@@ -413,6 +571,8 @@ Interpreter::GetIncludeFuncName(IncludeFile::Type t)
 		return "factory.include_config";
 	case IncludeFile::SCRIPT:
 		return "factory.include_script";
+	case IncludeFile::MANIFEST:
+		return "factory.include_manifest";
 	default:
 		fprintf(stderr, "Illegal include file type %d\n", t);
 		abort();
@@ -428,13 +588,28 @@ Interpreter::Include()
 	std::string_view funcName = GetIncludeFuncName(type);
 	Lua::Parameter files(funcName, "files", 1);
 	Lua::Parameter configArg(funcName, "config", 2);
+	Lua::Parameter providesArg(funcName, "provides", 3);
 
 	auto fileList = GetStringList(lua, files);
 
 	Lua::Table configTable = lua.GetTable(configArg);
 	auto config = SerializeConfig(configTable);
 
-	includeQueue.emplace_back(std::move(fileList), type, std::move(config));
+	std::vector<std::string> targets;
+	std::vector<std::string> outputs;
+	Lua::ValueParser parser {
+		Lua::FieldSpec("targets", StringListField(targets)).Optional(true),
+		Lua::FieldSpec("outputs", StringListField(outputs)).Optional(true)
+	};
+
+	auto providesTable = lua.GetTable(providesArg);
+	providesTable.ParseMap(parser);
+
+	IncludeFile & include = includeQueue.emplace_back(std::move(fileList),
+	    type, std::move(config));
+	include.targets = std::move(targets);
+	for (const std::string & dir : outputs)
+		include.outputs.push_back(commandFactory.MakeAbsolute(dir));
 
 	return 0;
 }
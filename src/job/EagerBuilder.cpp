@@ -0,0 +1,325 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "EagerBuilder.h"
+
+#include "Command.h"
+#include "EventLoop.h"
+#include "FileStat.h"
+#include "Job.h"
+#include "JobManager.h"
+#include "NamedTarget.h"
+#include "Product.h"
+#include "ProductManager.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <stdio.h>
+
+EagerBuilder::EagerBuilder(EventLoop & l, JobManager & j, ProductManager & mgr,
+    const std::unordered_set<std::string_view> & targetSet)
+  : loop(l),
+    jobManager(j),
+    productManager(mgr),
+    running(0),
+    stopped(false)
+{
+	for (std::string_view target : targetSet) {
+		targets.emplace_back(target);
+	}
+}
+
+void
+EagerBuilder::EagerJob::JobComplete(Job * job, int status)
+{
+
+	builder.JobDone(command, status, job->GetJobId());
+}
+
+void
+EagerBuilder::EagerJob::Abort()
+{
+
+	command->Abort();
+}
+
+void
+EagerBuilder::CommandAdded(Command * command, const std::vector<Product*> & inputs)
+{
+	CommandInfo & info = commands[command];
+	bool wanted = false;
+
+	info.inputs = inputs;
+	for (Product * product : command->GetProducts()) {
+		Product * parent = productManager.FindProduct(product->GetPath().parent_path());
+		if (parent)
+			info.parents.push_back(parent);
+
+		/* Something that we already want needs this. */
+		if (wantedInputs.count(product) != 0)
+			wanted = true;
+	}
+
+	if (wanted)
+		MarkWanted(command);
+}
+
+/* Want the command, and every known command that makes one of its inputs. */
+void
+EagerBuilder::MarkWanted(Command * command)
+{
+	std::vector<Command*> stack;
+
+	stack.push_back(command);
+	while (!stack.empty()) {
+		Command * c = stack.back();
+		stack.pop_back();
+
+		auto it = commands.find(c);
+		if (it == commands.end() || it->second.wanted)
+			continue;
+
+		CommandInfo & info = it->second;
+		info.wanted = true;
+		candidates.push_back(c);
+
+		for (const std::vector<Product*> * list : {&info.parents, &info.inputs}) {
+			for (Product * input : *list) {
+				wantedInputs.insert(input);
+
+				Command * producer = input->GetCommand();
+				if (producer && producer != c)
+					stack.push_back(producer);
+			}
+		}
+	}
+}
+
+void
+EagerBuilder::AddTargetCommands()
+{
+	for (const std::string & name : targets) {
+		const NamedTarget * target = productManager.FindTarget(name);
+		if (!target)
+			continue;
+
+		const std::vector<Product*> & dependees = target->GetDependees();
+		size_t & seen = targetsSeen[name];
+		for (; seen < dependees.size(); ++seen) {
+			Command * command = dependees[seen]->GetCommand();
+			if (command)
+				MarkWanted(command);
+		}
+	}
+}
+
+EagerBuilder::Readiness
+EagerBuilder::InputReady(Product * input, bool isParent, Command *& blocker)
+{
+	/* We can't know what's in a directory until the graph is complete. */
+	if (!isParent && input->IsDirectory())
+		return Readiness::NEVER;
+
+	Command * producer = input->GetCommand();
+	if (producer) {
+		auto it = commands.find(producer);
+		if (it == commands.end() || !it->second.built) {
+			blocker = producer;
+			return Readiness::WAITING;
+		}
+
+		return Readiness::READY;
+	}
+
+	if (sources.count(input) != 0)
+		return Readiness::READY;
+
+	/* A later script might define the command that makes it. */
+	FileStat status = FileStat::Probe(input->GetPath());
+	if (!status.exists)
+		return Readiness::WAITING;
+
+	if (status.isDirectory != isParent)
+		return Readiness::NEVER;
+
+	sources.insert(input);
+	return Readiness::READY;
+}
+
+EagerBuilder::Readiness
+EagerBuilder::CheckReady(Command * command, Command *& blocker)
+{
+	CommandInfo & info = commands[command];
+	bool missing = false;
+
+	for (Product * product : command->GetProducts()) {
+		if (!FileStat::Probe(product->GetPath()).exists) {
+			missing = true;
+			break;
+		}
+	}
+
+	/* Whether it is out of date is left to the build. */
+	if (!missing)
+		return Readiness::NEVER;
+
+	for (Product * parent : info.parents) {
+		Readiness ready = InputReady(parent, true, blocker);
+		if (ready != Readiness::READY)
+			return ready;
+	}
+
+	for (Product * input : info.inputs) {
+		Readiness ready = InputReady(input, false, blocker);
+		if (ready != Readiness::READY)
+			return ready;
+	}
+
+	return Readiness::READY;
+}
+
+/* What ProductBuilt() is told a command read. */
+static std::vector<Product*>
+FileInputs(const std::vector<Product*> & inputs)
+{
+	std::vector<Product*> files;
+
+	for (Product * input : inputs) {
+		if (!input->IsDirectory())
+			files.push_back(input);
+	}
+
+	return files;
+}
+
+void
+EagerBuilder::StartReady()
+{
+	size_t i = 0;
+
+	while (!stopped && i < candidates.size() && !jobManager.IsFull()) {
+		Command * command = candidates[i];
+		Command * blocker = nullptr;
+
+		Readiness ready = CheckReady(command, blocker);
+		if (ready == Readiness::WAITING && !blocker) {
+			/* Try again once more scripts have been evaluated. */
+			++i;
+			continue;
+		}
+
+		/* Try again once a job that holds what it needs is done. */
+		if (ready == Readiness::READY && (!jobManager.CanStart(*command) ||
+		    !jobManager.AcquireToken())) {
+			++i;
+			continue;
+		}
+
+		candidates[i] = candidates.back();
+		candidates.pop_back();
+
+		if (ready == Readiness::WAITING) {
+			waiters[blocker].push_back(command);
+			continue;
+		}
+
+		if (ready == Readiness::NEVER)
+			continue;
+
+		std::vector<Product*> files(FileInputs(commands[command].inputs));
+		for (Product * product : command->GetProducts())
+			productManager.BuildStarting(product, files);
+
+		auto job = std::make_unique<EagerJob>(*this, command);
+		if (!jobManager.StartJob(*command, *job)) {
+			warn("Could not start job for '%s'",
+			    command->GetProducts().front()->GetPath().c_str());
+			stopped = true;
+			break;
+		}
+
+		jobs.push_back(std::move(job));
+		running++;
+	}
+}
+
+void
+EagerBuilder::JobDone(Command * command, int status, uint64_t jobId)
+{
+	CommandInfo & info = commands[command];
+
+	running--;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		/*
+		 * The command might only have failed because of an input that
+		 * a later script adds, so leave it to the build to run again.
+		 */
+		fprintf(stderr, "Job %ju: '%s' failed; waiting for every script to be evaluated\n",
+		    (uintmax_t)jobId, command->GetProducts().front()->GetPath().c_str());
+		stopped = true;
+		return;
+	}
+
+	info.built = true;
+
+	std::vector<Product*> files(FileInputs(info.inputs));
+	for (Product * product : command->GetProducts()) {
+		fprintf(stderr, "Job %ju: '%s' is built\n", (uintmax_t)jobId,
+		    product->GetPath().c_str());
+		productManager.ProductBuilt(product, files);
+	}
+
+	auto it = waiters.find(command);
+	if (it != waiters.end()) {
+		candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+		waiters.erase(it);
+	}
+
+	StartReady();
+}
+
+void
+EagerBuilder::Update()
+{
+
+	loop.Poll();
+	AddTargetCommands();
+	StartReady();
+}
+
+void
+EagerBuilder::Finish()
+{
+
+	stopped = true;
+	while (running > 0)
+		loop.Run();
+}
@@ -39,12 +39,16 @@
 #include <fcntl.h>
 #include <signal.h>
 
-Job::Job(JobCompletion &c, int id, pid_t pid, Path wd)
+Job::Job(JobCompletion &c, const Command & cmd, int id, pid_t pid, Path wd)
   : completer(c),
+    command(cmd),
     jobId(id),
     pid(pid),
-    workdir(std::move(wd))
+    workdir(std::move(wd)),
+    running(1),
+    status(0)
 {
+	clock_gettime(CLOCK_MONOTONIC, &start);
 }
 
 Job::~Job()
@@ -60,9 +64,44 @@ Job::Complete(int status)
 void
 Job::Abort()
 {
-	int status;
+	int exitStatus;
 
 	kill(-pid, SIGTERM);
-	waitpid(pid, &status, 0);
+	waitpid(pid, &exitStatus, 0);
+
+	for (pid_t p : upstream) {
+		kill(-p, SIGTERM);
+		waitpid(p, &exitStatus, 0);
+	}
+
 	completer.Abort();
 }
+
+uint64_t
+Job::GetElapsed() const
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) * 1000 +
+	    (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+void
+Job::AddUpstream(pid_t upstreamPid)
+{
+
+	upstream.push_back(upstreamPid);
+	running++;
+}
+
+bool
+Job::ProcessExited(int exitStatus)
+{
+
+	if (status == 0)
+		status = exitStatus;
+
+	running--;
+	return running == 0;
+}
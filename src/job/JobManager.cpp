@@ -30,8 +30,12 @@
 
 #include "EventLoop.h"
 #include "Job.h"
+#include "JobHistory.h"
 #include "JobQueue.h"
+#include "JobServer.h"
 #include "MsgSocket.h"
+#include "Product.h"
+#include "ResourcePool.h"
 #include "Sandbox.h"
 #include "SandboxFactory.h"
 
@@ -46,6 +50,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <cassert>
@@ -57,13 +62,23 @@
 // Not defined by any header(!)
 extern char ** environ;
 
+/* How many inputs PrefetchInputs() may open at a time. */
+#define MAX_PREFETCH_OPENS	8
+
 static int
 StartChild(const std::vector<char *> & argp, const std::vector<char *> & envpm,
-    Sandbox & boxer, const Command & command) __attribute__((noreturn));
+    Sandbox & boxer, const Command & command, const JobServer * jobServer,
+    int stdinFd, int stdoutFd)
+    __attribute__((noreturn));
 
+/*
+ * stdinFd and stdoutFd are pipes to the neighbouring commands of a pipeline,
+ * or -1 to use the files that the command asked for.
+ */
 static int
 StartChild(const std::vector<char *> & argp, const std::vector<char *> & envp,
-    Sandbox & sandbox, const Command & command)
+    Sandbox & sandbox, const Command & command, const JobServer * jobServer,
+    int stdinFd, int stdoutFd)
 {
 	int fd, error;
 
@@ -86,9 +101,13 @@ StartChild(const std::vector<char *> & argp, const std::vector<char *> & envp,
 		stdin_file = "/dev/null";
 	}
 
-	fd = open(stdin_file, O_RDONLY);
-	if (fd < 0) {
-		err(1, "Could not open '%s' for reading\n", stdin_file);
+	if (stdinFd >= 0) {
+		fd = stdinFd;
+	} else {
+		fd = open(stdin_file, O_RDONLY);
+		if (fd < 0) {
+			err(1, "Could not open '%s' for reading\n", stdin_file);
+		}
 	}
 
 	fd = dup2(fd, STDIN_FILENO);
@@ -97,10 +116,14 @@ StartChild(const std::vector<char *> & argp, const std::vector<char *> & envp,
 	}
 
 	auto stdout = command.GetStdout();
-	if (stdout) {
-		fd = open(stdout->c_str(), O_WRONLY | O_CREAT, 0700);
-		if (fd < 0) {
-			err(1, "Could not open '%s' for writing\n", stdout->c_str());
+	if (stdout || stdoutFd >= 0) {
+		if (stdoutFd >= 0) {
+			fd = stdoutFd;
+		} else {
+			fd = open(stdout->c_str(), O_WRONLY | O_CREAT, 0700);
+			if (fd < 0) {
+				err(1, "Could not open '%s' for writing\n", stdout->c_str());
+			}
 		}
 
 		fd = dup2(fd, STDOUT_FILENO);
@@ -109,6 +132,9 @@ StartChild(const std::vector<char *> & argp, const std::vector<char *> & envp,
 		}
 	}
 
+	if (jobServer)
+		jobServer->Inherit();
+
 	sandbox.Enable();
 
 	fexecve(sandbox.GetExecFd(), &argp[0], &envp[0]);
@@ -121,7 +147,12 @@ JobManager::JobManager(EventLoop & loop, JobQueue &q, std::unique_ptr<SandboxFac
     jobQueue(q),
     sandboxFactory(std::move(f)),
     maxRunning(max),
-    next_job_id(0)
+    cpusInUse(0),
+    memoryInUse(0),
+    memoryLimit(GetPhysicalMemory()),
+    next_job_id(0),
+    history(nullptr),
+    jobServer(nullptr)
 
 {
 	loop.RegisterSignal(this, SIGCHLD);
@@ -134,6 +165,71 @@ JobManager::~JobManager()
 	}
 }
 
+/* In MiB. */
+uint64_t
+JobManager::GetPhysicalMemory()
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+
+	if (pages <= 0 || pageSize <= 0)
+		return UINT64_MAX;
+
+	return static_cast<uint64_t>(pages) * pageSize / (1024 * 1024);
+}
+
+/*
+ * A command can start if every stage of it has room in its pool, and there
+ * are enough job slots and memory left for all of them.  A command that
+ * asks for more than we have can still run once nothing else is.
+ */
+bool
+JobManager::CanStart(const Command & command) const
+{
+	size_t cpus = 0;
+	uint64_t memory = 0;
+
+	for (const Command * c = &command; c; c = c->GetUpstream()) {
+		if (c->GetPool() && c->GetPool()->IsFull())
+			return false;
+
+		cpus += c->GetCpus();
+		memory += c->GetMemory();
+	}
+
+	if (pidMap.empty())
+		return true;
+
+	return cpusInUse + cpus <= maxRunning &&
+	    memoryInUse + memory <= memoryLimit;
+}
+
+void
+JobManager::AcquireResources(const Command & command)
+{
+
+	for (const Command * c = &command; c; c = c->GetUpstream()) {
+		if (c->GetPool())
+			c->GetPool()->Acquire();
+
+		cpusInUse += c->GetCpus();
+		memoryInUse += c->GetMemory();
+	}
+}
+
+void
+JobManager::ReleaseResources(const Command & command)
+{
+
+	for (const Command * c = &command; c; c = c->GetUpstream()) {
+		if (c->GetPool())
+			c->GetPool()->Release();
+
+		cpusInUse -= c->GetCpus();
+		memoryInUse -= c->GetMemory();
+	}
+}
+
 uint64_t
 JobManager::AllocJobId()
 {
@@ -141,14 +237,13 @@ JobManager::AllocJobId()
 	return next_job_id;
 }
 
-Job*
-JobManager::StartJob(Command & command, JobCompletion & completer)
+pid_t
+JobManager::Spawn(Command & command, uint64_t jobId, int stdinFd, int stdoutFd)
 {
 	std::vector<char *>  argp;
 	const ArgList & argList = command.GetArgList();
 	std::ostringstream commandStr;
 
-	uint64_t jobId = AllocJobId();
 	Sandbox &sandbox = sandboxFactory->MakeSandbox(jobId, command);
 
 	sandbox.ArgvPrepend(argp);
@@ -162,28 +257,108 @@ JobManager::StartJob(Command & command, JobCompletion & completer)
 
 	fprintf(stderr, "Run: \"%s\" as job %lld\n", commandStr.str().c_str(), (long long)jobId);
 
+	const JobServer * js = command.UsesJobServer() ? jobServer : nullptr;
+
 	std::vector<char *> envp;
 	for (int i = 0; environ[i] != NULL; ++i) {
+		if (js && strncmp(environ[i], "MAKEFLAGS=", 10) == 0)
+			continue;
 		envp.push_back(environ[i]);
 	}
+	if (js)
+		envp.push_back(const_cast<char*>(js->GetMakeflags().c_str()));
 	sandbox.EnvironAppend(envp);
 	envp.push_back(NULL);
 
 	pid_t child = fork();
+	if (child == 0)
+		StartChild(argp, envp, sandbox, command, js, stdinFd, stdoutFd);
+
+	if (child > 0)
+		sandbox.ParentCleanup();
+	return child;
+}
+
+/*
+ * A command whose stdin is streamed from other commands starts together
+ * with them, connected by pipes.  They are all one job, which completes
+ * when the last of them exits.
+ */
+Job*
+JobManager::StartJob(Command & command, JobCompletion & completer)
+{
+	std::vector<Command *> stages;
+	std::vector<UpstreamProcess> upstream;
+	std::vector<pid_t> upstreamPids;
+	int input = -1;
+
+	for (Command * c = command.GetUpstream(); c; c = c->GetUpstream())
+		stages.push_back(c);
+
+	/* Start from the head of the pipeline. */
+	for (auto it = stages.rbegin(); it != stages.rend(); ++it) {
+		int fds[2];
+
+		if (pipe2(fds, O_CLOEXEC) != 0)
+			err(1, "Could not create pipe");
+
+		uint64_t stageId = AllocJobId();
+		pid_t pid = Spawn(**it, stageId, input, fds[1]);
+		if (pid < 0)
+			err(1, "Could not start '%s'", (*it)->GetArgList().front().c_str());
+
+		close(fds[1]);
+		if (input >= 0)
+			close(input);
+		input = fds[0];
+
+		upstream.push_back(UpstreamProcess{nullptr, stageId});
+		upstreamPids.push_back(pid);
+	}
+
+	uint64_t jobId = AllocJobId();
+	pid_t child = Spawn(command, jobId, input, -1);
+	if (input >= 0)
+		close(input);
 	if (child < 0)
 		return NULL;
 
-	if (child == 0) {
-		StartChild(argp, envp, sandbox, command);
-	} else {
-		sandbox.ParentCleanup();
+	auto job = std::make_unique<Job>(completer, command, jobId, child,
+	    command.GetWorkDir());
+	for (size_t i = 0; i < upstream.size(); ++i) {
+		upstream[i].job = job.get();
+		job->AddUpstream(upstreamPids[i]);
+		upstreamMap.insert(std::make_pair(upstreamPids[i], upstream[i]));
+	}
 
-		auto job = std::make_unique<Job>(completer, jobId, child, command.GetWorkDir());
+	AcquireResources(command);
 
-		auto ins = pidMap.insert(std::make_pair(child, std::move(job)));
-		assert (ins.second);
-		return ins.first->second.get();
+	auto ins = pidMap.insert(std::make_pair(child, std::move(job)));
+	assert (ins.second);
+	return ins.first->second.get();
+}
+
+/* Returns the job that the exited process was part of. */
+Job *
+JobManager::FindExited(pid_t pid)
+{
+	Job * job;
+
+	auto up = upstreamMap.find(pid);
+	if (up != upstreamMap.end()) {
+		job = up->second.job;
+		sandboxFactory->ReleaseSandbox(up->second.sandboxId);
+		upstreamMap.erase(up);
+		return job;
 	}
+
+	auto it = pidMap.find(pid);
+	if (it == pidMap.end()) {
+		fprintf(stderr, "Unknown child %d exited!\n", pid);
+		return nullptr;
+	}
+
+	return it->second.get();
 }
 
 void
@@ -204,25 +379,121 @@ JobManager::Dispatch(int sig, short flags)
 				err(1, "wait3 failed");
 		}
 
-		auto it = pidMap.find(pid);
-		if (it == pidMap.end()) {
-			fprintf(stderr, "Unknown child %d exited!\n", pid);
+		Job * exited = FindExited(pid);
+		if (!exited || !exited->ProcessExited(status))
 			continue;
-		}
 
-		it->second->Complete(status);
-		sandboxFactory->ReleaseSandbox(it->second->GetJobId());
+		/*
+		 * The job gives up everything that it holds before its
+		 * completion starts more jobs.
+		 */
+		auto it = pidMap.find(exited->GetPid());
+		std::unique_ptr<Job> job = std::move(it->second);
 		pidMap.erase(it);
 
+		if (history && job->GetStatus() == 0)
+			history->Record(job->GetCommand(), job->GetElapsed());
+
+		ReleaseResources(job->GetCommand());
+		ReleaseTokens();
+		job->Complete(job->GetStatus());
+		sandboxFactory->ReleaseSandbox(job->GetJobId());
+
 		ScheduleJob();
 	}
 }
 
+/*
+ * Have the kernel start reading the inputs of the commands that will run
+ * next, so that they are cached by the time that the commands open them.
+ * posix_fadvise() doesn't wait for the reads, but open() can, on a cold or
+ * network filesystem; as this runs every time a job finishes, each call
+ * only opens a few of the inputs and leaves the rest for later calls.
+ */
+void
+JobManager::PrefetchInputs()
+{
+
+	for (Command * command : jobQueue.LookAhead(maxRunning)) {
+		for (Product * input : command->GetProducts().front()->GetInputs()) {
+			if (input->IsAggregate() || input->IsDirectory())
+				continue;
+			if (input->StatusValid() && !input->GetStatus().exists)
+				continue;
+			if (prefetched.insert(input->GetPath()).second)
+				prefetchQueue.push_back(input->GetPath());
+		}
+	}
+
+	for (int i = 0; i < MAX_PREFETCH_OPENS && !prefetchQueue.empty(); ++i) {
+		/* Don't block on a FIFO. */
+		int fd = open(prefetchQueue.front().c_str(),
+		    O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		prefetchQueue.pop_front();
+		if (fd < 0)
+			continue;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+}
+
+void
+JobManager::SetMaxRunning(size_t max)
+{
+	bool raised = max > maxRunning;
+
+	maxRunning = max;
+	if (raised && !pidMap.empty())
+		ScheduleJob();
+}
+
+void
+JobManager::SetJobServer(JobServer * js)
+{
+
+	jobServer = js;
+	jobServer->SetListener([this]
+	    {
+		if (!pidMap.empty())
+			ScheduleJob();
+	    });
+}
+
+bool
+JobManager::AcquireToken()
+{
+
+	if (!jobServer || pidMap.empty() || jobServer->GetHeld() >= pidMap.size())
+		return true;
+
+	return jobServer->Acquire();
+}
+
+/* Give back the tokens of the jobs that have finished. */
+void
+JobManager::ReleaseTokens()
+{
+
+	if (!jobServer)
+		return;
+
+	size_t needed = pidMap.empty() ? 0 : pidMap.size() - 1;
+	while (jobServer->GetHeld() > needed)
+		jobServer->Release();
+}
+
 bool
 JobManager::ScheduleJob()
 {
-	while (pidMap.size() < maxRunning) {
-		Command * command = jobQueue.RemoveNext();
+	while (cpusInUse < maxRunning) {
+		if (!AcquireToken())
+			break;
+
+		Command * command = jobQueue.RemoveNext([this](const Command & c)
+		    {
+			return CanStart(c);
+		    });
 
 		if (command == nullptr) {
 			if (pidMap.empty())
@@ -232,5 +503,10 @@ JobManager::ScheduleJob()
 
 		StartJob(*command, *command);
 	}
+
+	/* A token taken for a command that couldn't start. */
+	ReleaseTokens();
+
+	PrefetchInputs();
 	return pidMap.size() > 0;
 }
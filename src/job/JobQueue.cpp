@@ -37,16 +37,49 @@ JobQueue::RemoveNext()
 	if (queue.empty())
 		return nullptr;
 
-	Command *j = queue.front();
-	queue.pop_front();
+	auto it = queue.begin();
+	Command *j = it->command;
+	queue.erase(it);
+	seen.erase(j);
 	return j;
 }
 
+Command *
+JobQueue::RemoveNext(const std::function<bool(const Command &)> & canRun)
+{
+	for (auto it = queue.begin(); it != queue.end(); ++it) {
+		Command *j = it->command;
+
+		if (canRun(*j)) {
+			queue.erase(it);
+			seen.erase(j);
+			return j;
+		}
+	}
+
+	return nullptr;
+}
+
 void
 JobQueue::Submit(Command *j)
 {
 	if (!j->WasQueued()) {
 		j->SetQueued();
-		queue.push_back(j);
+		queue.insert(Entry{j->GetCriticalPath(), j->GetFanOut(),
+		    submitted++, j});
 	}
 }
+
+std::vector<Command*>
+JobQueue::LookAhead(size_t count)
+{
+	std::vector<Command*> commands;
+	size_t i = 0;
+
+	for (auto it = queue.begin(); it != queue.end() && i < count; ++it, ++i) {
+		if (seen.insert(it->command).second)
+			commands.push_back(it->command);
+	}
+
+	return commands;
+}
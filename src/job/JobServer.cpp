@@ -0,0 +1,304 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "JobServer.h"
+
+#include "EventLoop.h"
+#include "StateFile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <initializer_list>
+
+JobServer::JobServer(EventLoop & loop, int r, int w)
+  : readFd(r),
+    writeFd(w),
+    waiting(false),
+    closed(false)
+{
+	loop.RegisterPipe(this, readFd);
+}
+
+JobServer::~JobServer()
+{
+
+	/* The tokens that we hold still belong to the jobserver. */
+	while (!tokens.empty())
+		Release();
+
+	if (waiting)
+		Disable();
+
+	if (fifo)
+		unlink(fifo->c_str());
+	if (writeFd != readFd)
+		close(writeFd);
+	close(readFd);
+}
+
+/*
+ * Find the last --jobserver-auth (or, from makes older than 4.2,
+ * --jobserver-fds) in MAKEFLAGS; a sub-make that was given its own -j
+ * appends its own jobserver after its parent's.
+ */
+bool
+JobServer::ParseAuth(std::string_view flags, std::string_view & auth)
+{
+	bool found = false;
+	size_t pos = 0;
+
+	while (pos < flags.size()) {
+		size_t end = flags.find(' ', pos);
+		if (end == std::string_view::npos)
+			end = flags.size();
+
+		std::string_view word = flags.substr(pos, end - pos);
+		for (std::string_view prefix :
+		    {"--jobserver-auth=", "--jobserver-fds="}) {
+			if (word.substr(0, prefix.size()) == prefix) {
+				auth = word.substr(prefix.size());
+				found = true;
+			}
+		}
+		pos = end + 1;
+	}
+
+	return found;
+}
+
+/*
+ * Drop the -j and jobserver words from MAKEFLAGS, keeping everything else
+ * (-k, -s, variable overrides...) for the commands that we run.  Each word
+ * is followed by a space, ready for our own flags.
+ */
+std::string
+JobServer::StripJobFlags(std::string_view flags)
+{
+	std::string stripped;
+	size_t pos = 0;
+
+	while (pos < flags.size()) {
+		size_t end = flags.find(' ', pos);
+		if (end == std::string_view::npos)
+			end = flags.size();
+
+		std::string_view word = flags.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (word.empty() || word.substr(0, 2) == "-j" ||
+		    word.substr(0, 12) == "--jobserver-")
+			continue;
+
+		stripped += word;
+		stripped += ' ';
+	}
+
+	return stripped;
+}
+
+std::unique_ptr<JobServer>
+JobServer::Connect(EventLoop & loop)
+{
+	std::unique_ptr<JobServer> server;
+	std::string_view auth;
+	int r, w = -1;
+
+	const char * env = getenv("MAKEFLAGS");
+	if (env == nullptr || !ParseAuth(env, auth))
+		return nullptr;
+
+	if (auth.substr(0, 5) == "fifo:") {
+		std::string path(auth.substr(5));
+
+		r = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (r < 0) {
+			warn("Could not open jobserver FIFO '%s'", path.c_str());
+			return nullptr;
+		}
+		w = r;
+	} else {
+		std::string fds(auth);
+		char * end;
+
+		r = strtol(fds.c_str(), &end, 10);
+		if (*end == ',')
+			w = strtol(end + 1, &end, 10);
+		if (end == fds.c_str() || *end != '\0' || r < 0 || w < 0) {
+			warnx("Ignoring unknown jobserver '%s'", fds.c_str());
+			return nullptr;
+		}
+
+		/* make only passes the pipe on to the rules marked with '+'. */
+		if (fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0) {
+			warnx("The jobserver is unavailable; add '+' to the make rule that runs factory");
+			return nullptr;
+		}
+
+		/*
+		 * Our commands only get the pipe if they ask for it.  It is
+		 * non-blocking for the other users of the pipe too, but make
+		 * copes with that.
+		 */
+		fcntl(r, F_SETFD, FD_CLOEXEC);
+		fcntl(w, F_SETFD, FD_CLOEXEC);
+		fcntl(r, F_SETFL, fcntl(r, F_GETFL) | O_NONBLOCK);
+	}
+
+	server.reset(new JobServer(loop, r, w));
+
+	/*
+	 * A FIFO might be outside of the sandbox of our commands, so we
+	 * always pass the jobserver on as descriptors.
+	 */
+	server->makeflags = "MAKEFLAGS=" + StripJobFlags(env) +
+	    "-j --jobserver-auth=" + std::to_string(r) + "," + std::to_string(w);
+	return server;
+}
+
+std::unique_ptr<JobServer>
+JobServer::Create(EventLoop & loop, size_t jobs, bool useFifo)
+{
+	std::unique_ptr<JobServer> server;
+	std::string auth;
+
+	if (useFifo) {
+		std::error_code code;
+		Path path = GetStateFilePath(JOBSERVER_FIFO).absolute(code);
+		if (code)
+			errx(1, "Could not find the state directory: %s",
+			    code.message().c_str());
+
+		Path parent = path.parent_path();
+
+		if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST)
+			err(1, "Could not create '%s'", parent.c_str());
+
+		/* Left behind by a factory that was killed. */
+		unlink(path.c_str());
+		if (mkfifo(path.c_str(), 0600) != 0)
+			err(1, "Could not create jobserver FIFO '%s'", path.c_str());
+
+		int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			err(1, "Could not open jobserver FIFO '%s'", path.c_str());
+
+		server.reset(new JobServer(loop, fd, fd));
+		server->fifo = path;
+		auth = "fifo:" + path.string();
+	} else {
+		int fds[2];
+
+		if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+			err(1, "Could not create jobserver pipe");
+
+		server.reset(new JobServer(loop, fds[0], fds[1]));
+		auth = std::to_string(fds[0]) + "," + std::to_string(fds[1]);
+	}
+
+	/* The first job slot is implicit. */
+	std::string slots(jobs > 0 ? jobs - 1 : 0, '+');
+	ssize_t len = write(server->writeFd, slots.data(), slots.size());
+	if (len != static_cast<ssize_t>(slots.size()))
+		err(1, "Could not fill the jobserver");
+
+	const char * env = getenv("MAKEFLAGS");
+	server->makeflags = "MAKEFLAGS=" + StripJobFlags(env ? env : "") +
+	    "-j" + std::to_string(jobs) + " --jobserver-auth=" + auth;
+	return server;
+}
+
+bool
+JobServer::Acquire()
+{
+	char token;
+
+	if (closed)
+		return false;
+
+	ssize_t len = read(readFd, &token, 1);
+	if (len == 1) {
+		tokens.push_back(token);
+		return true;
+	}
+
+	if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+		/* We can still run one job at a time without it. */
+		if (len == 0)
+			warnx("The jobserver has exited");
+		else
+			warn("Could not read from the jobserver");
+		closed = true;
+		return false;
+	}
+
+	if (!waiting) {
+		Enable();
+		waiting = true;
+	}
+	return false;
+}
+
+void
+JobServer::Release()
+{
+	char token = tokens.back();
+
+	tokens.pop_back();
+	if (write(writeFd, &token, 1) != 1)
+		warn("Could not return a token to the jobserver");
+}
+
+void
+JobServer::Dispatch(int fd, short flags)
+{
+
+	Disable();
+	waiting = false;
+
+	if (listener)
+		listener();
+}
+
+void
+JobServer::Inherit() const
+{
+
+	/* Commands open a FIFO that we created by its path. */
+	if (fifo)
+		return;
+
+	fcntl(readFd, F_SETFD, 0);
+	fcntl(writeFd, F_SETFD, 0);
+}
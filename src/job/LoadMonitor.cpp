@@ -0,0 +1,97 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "LoadMonitor.h"
+
+#include "EventLoop.h"
+#include "JobManager.h"
+
+#include <sys/time.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+/* How often to sample the load average. */
+#define LOAD_SAMPLE_SECS	2
+
+LoadMonitor::LoadMonitor(EventLoop & loop, JobManager & jm, size_t min, size_t max)
+  : jobManager(jm),
+    minJobs(min),
+    maxJobs(max),
+    numCpus(GetNumCpus())
+{
+	struct timeval interval = {LOAD_SAMPLE_SECS, 0};
+
+	jobManager.SetMaxRunning(std::clamp(numCpus, minJobs, maxJobs));
+	loop.RegisterTimer(this, interval);
+}
+
+size_t
+LoadMonitor::GetNumCpus()
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? cpus : 1;
+}
+
+size_t
+LoadMonitor::DefaultMaxJobs()
+{
+
+	return GetNumCpus();
+}
+
+void
+LoadMonitor::Dispatch(int fd, short flags)
+{
+	double load;
+
+	if (getloadavg(&load, 1) != 1)
+		return;
+
+	/*
+	 * Our own jobs are part of the load; whatever is left over is other
+	 * work that we are competing with.
+	 */
+	double others = std::max(load - jobManager.GetRunning(), 0.0);
+	double target = numCpus - others;
+	size_t limit = jobManager.GetMaxRunning();
+
+	/* There's no point in raising a limit that we aren't reaching. */
+	if (target >= limit + 1 && limit < maxJobs &&
+	    jobManager.GetRunning() >= limit)
+		limit++;
+	else if (target < limit - 1.0 && limit > minJobs)
+		limit--;
+	else
+		return;
+
+	jobManager.SetMaxRunning(limit);
+}
@@ -5,6 +5,9 @@ SUBDIRS := \
 LIB :=	job
 
 SRCS := \
+	EagerBuilder.cpp \
 	Job.cpp \
 	JobManager.cpp \
 	JobQueue.cpp \
+	JobServer.cpp \
+	LoadMonitor.cpp \
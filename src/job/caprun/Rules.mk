@@ -12,11 +12,13 @@ PROG_LIBS := \
 	msgsocket \
 	eventloop \
 	temp_files \
+	util \
 
 PROG_STDLIBS := \
 	event_core \
 	elf \
 	gbpf \
+	pthread \
 
 LIB :=	caprun
 
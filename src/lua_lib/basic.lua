@@ -20,18 +20,51 @@ function factory.define_command(products, inputs, arglist, options)
 	    factory.listify(options))
 end
 
+-- Declare directories whose contents only change when the fingerprint does:
+-- options.stamp if given, or else the directory itself.  Commands that
+-- list these directories (or anything under them) as inputs are rebuilt
+-- when the fingerprint is modified, without reading the directories.
+function factory.define_input_root(paths, options)
+	factory.internal.define_input_root(factory.listify(paths),
+	    factory.listify(options))
+end
+
+-- Declare a pool that at most options.depth commands may run in at once.
+-- Commands join it with the pool option to define_command, which also takes
+-- the number of job slots a command uses (cpus, default 1) and the MiB of
+-- memory that it is expected to need (memory).
+function factory.define_pool(name, options)
+	factory.internal.define_pool(name, factory.listify(options))
+end
+
 function factory.define_mkdir(...)
 	for _, d in ipairs{...} do
 		factory.define_command(d, {"/bin", "/lib"}, {"mkdir", d}, {})
 	end
 end
 
-function factory.include_config(paths, config)
-	factory.internal.include_config(factory.listify(paths), config)
+-- The system directories only change on upgrades; don't read them every build.
+factory.define_input_root({"/bin", "/lib"})
+
+-- provides, if given, declares what the include contributes to the build:
+-- provides.targets lists the targets that it adds commands to, and
+-- provides.outputs the directories that all of its products are under.
+-- Such an include is only evaluated when the requested targets need it.
+function factory.include_config(paths, config, provides)
+	factory.internal.include_config(factory.listify(paths), config,
+	    factory.listify(provides))
+end
+
+function factory.include_script(paths, config, provides)
+	factory.internal.include_script(factory.listify(paths), config,
+	    factory.listify(provides))
 end
 
-function factory.include_script(paths, config)
-	factory.internal.include_script(factory.listify(paths), config)
+-- Define the commands listed in manifests (see Manifest.h), without going
+-- through Lua for each one.
+function factory.include_manifest(paths, provides)
+	factory.internal.include_manifest(factory.listify(paths), {},
+	    factory.listify(provides))
 end
 
 function factory.file_ext(file)
@@ -7,6 +7,7 @@ PROG := bin/factory
 
 PROG_LIBS := \
 	main \
+	daemon \
 	interpreter \
 	lua \
 	ingest \
@@ -15,6 +16,7 @@ PROG_LIBS := \
 	product \
 	capsicum_sb \
 	ebpf \
+	preload_sb \
 	msgsocket \
 	eventloop \
 	config \
@@ -27,3 +29,4 @@ PROG_STDLIBS := \
 	gbpf \
 	ucl \
 	lua-5.3 \
+	pthread \
@@ -26,61 +26,236 @@
  * SUCH DAMAGE.
  */
 
+#include "AccessLog.h"
+#include "BuildDaemon.h"
 #include "CapsicumSandboxFactory.h"
 #include "CommandFactory.h"
 #include "ConfigNode.h"
 #include "ConfigParser.h"
+#include "DaemonClient.h"
+#include "DepsLog.h"
+#include "DigestDatabase.h"
+#include "EagerBuilder.h"
 #include "EventLoop.h"
+#include "GraphCache.h"
 #include "Interpreter.h"
 #include "Job.h"
+#include "JobHistory.h"
 #include "JobManager.h"
 #include "JobQueue.h"
+#include "JobServer.h"
+#include "LoadMonitor.h"
+#include "Manifest.h"
+#include "MappedFile.h"
 #include "Product.h"
+#include "PreloadSandboxerFactory.h"
 #include "ProductManager.h"
+#include "StatCache.h"
+#include "StateFile.h"
 #include "TempFileManager.h"
 #include "TempFile.h"
 
 #include <err.h>
 #include <libelf.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <limits>
+#include <list>
 #include <sstream>
 #include <string>
 #include <vector>
 
+/*
+ * Only the preload sandbox (-P) reports the files that each command opens,
+ * so directory inputs are only narrowed to the files that a command read
+ * (see AccessLog) when it is used.  It interposes on libc, so it can't
+ * confine commands the way that Capsicum does.
+ */
 std::unique_ptr<SandboxFactory>
-GetSandboxerFactory(TempFileManager & tmpMgr, EventLoop &loop, int maxJobs)
+GetSandboxerFactory(TempFileManager & tmpMgr, EventLoop &loop, int maxJobs,
+    bool preload)
 {
+	if (preload)
+		return std::make_unique<PreloadSandboxerFactory>(tmpMgr, loop, maxJobs);
+
 	return std::make_unique<CapsicumSandboxFactory>();
 }
 
+/*
+ * How many jobs to run at once: a fixed number, or with -j auto, a range
+ * that the LoadMonitor adapts the limit within.  Unless factory was run by a
+ * make with a jobserver, it shares the max job slots with the makes that it
+ * runs through a jobserver of its own, in a pipe or (with -J fifo) a FIFO.
+ */
+struct JobLimit
+{
+	int min;
+	int max;
+	bool adaptive;
+	bool jobServerFifo;
+};
+
+/* Where a daemon started with -d listens for builds requested with -D. */
+#define DAEMON_SOCKET	"daemon.sock"
+
+/*
+ * The names of the configurations are the names of their files, less the
+ * extension.
+ */
+static std::vector<std::string>
+ConfigurationNames(const std::vector<Path> & configFiles)
+{
+	std::vector<std::string> names;
+
+	for (const Path & path : configFiles) {
+		std::string name = path.stem().string();
+
+		if (std::find(names.begin(), names.end(), name) != names.end())
+			errx(1, "Configuration '%s' given more than once", name.c_str());
+		names.push_back(name);
+	}
+
+	return names;
+}
+
+/* Every command in the build, before any of them has been scheduled. */
+struct BuildGraph
+{
+	JobQueue jq;
+	ProductManager productMgr;
+	CommandFactory commandFactory;
+
+	BuildGraph(GraphCache * cache)
+	  : productMgr(jq),
+	    commandFactory(productMgr, cache)
+	{
+	}
+};
+
+/* An include that is left out until something that it provides is needed. */
+struct DeferredInclude
+{
+	Interpreter & interp;
+	std::string configuration;
+	IncludeFile file;
+
+	DeferredInclude(Interpreter & i, const std::string & c, IncludeFile && f)
+	  : interp(i),
+	    configuration(c),
+	    file(std::move(f))
+	{
+	}
+};
+
+/* Is path dir, or something under it? */
+static bool
+PathIsUnder(Path path, const Path & dir)
+{
+	while (path != dir) {
+		Path parent(path.parent_path());
+		if (parent.empty() || parent == path)
+			return false;
+		path = std::move(parent);
+	}
+
+	return true;
+}
+
 class Main
 {
 private:
 	EventLoop loop;
 	TempFileManager tmpMgr;
-	JobQueue jq;
-	ProductManager productMgr;
-	CommandFactory commandFactory;
+	std::unique_ptr<DigestDatabase> digestDb;
+	AccessLog accessLog;
+	DepsLog depsLog;
+	JobHistory jobHistory;
+	GraphCache graphCache;
+	std::unique_ptr<BuildGraph> ownGraph;
+	BuildGraph & graph;
+	bool evaluated;
+	std::unique_ptr<JobServer> jobServer;
 	JobManager jobManager;
-	Interpreter interp;
+	std::unique_ptr<LoadMonitor> loadMonitor;
+	std::unique_ptr<EagerBuilder> eager;
+	std::list<DeferredInclude> deferred;
+	std::vector<Path> configFiles;
+	bool useGraphCache;
+	bool eagerBuild;
 
+	void RunScript(Interpreter & interp, const std::string & path, const ConfigNode & config);
 	void IncludeScript(Interpreter & interp, const IncludeFile & file);
 	void IncludeConfig(Interpreter & interp, const IncludeFile & file);
+	void IncludeManifest(const IncludeFile & file);
+	void Include(Interpreter & interp, const IncludeFile & file);
+	void EvaluateIncludes(Interpreter & interp, const std::string & configuration);
+	void EvaluateScripts(Interpreter & interp, const std::string & configuration);
+	bool IncludeNeeded(const DeferredInclude & include,
+	    const std::unordered_set<std::string_view> &targets,
+	    const std::vector<Path> & inputs, const std::vector<Path> & parents);
+	void EvaluateDeferred(const std::unordered_set<std::string_view> &targets);
+	bool EvaluateConfigurations(const std::unordered_set<std::string_view> &targets);
 
 public:
-	Main(int maxJobs)
-	  : productMgr(jq),
-	    commandFactory(productMgr),
-	    jobManager(loop, jq, GetSandboxerFactory(tmpMgr, loop, maxJobs), maxJobs),
-	    interp(commandFactory)
+	/*
+	 * If resident is given, it already holds every command and the build
+	 * scripts aren't evaluated.
+	 */
+	Main(const JobLimit & jobs, bool useCache, bool contentDigests,
+	    bool preloadSandbox, bool eagerMode, std::vector<Path> && configs,
+	    BuildGraph * resident = nullptr)
+	  : accessLog(GetStateFilePath("access.log")),
+	    depsLog(GetStateFilePath("deps.log")),
+	    jobHistory(GetStateFilePath("job.history")),
+	    graphCache(GetStateFilePath("graph.cache")),
+	    ownGraph(resident ? nullptr : std::make_unique<BuildGraph>(&graphCache)),
+	    graph(resident ? *resident : *ownGraph),
+	    evaluated(resident != nullptr),
+	    jobManager(loop, graph.jq,
+	        GetSandboxerFactory(tmpMgr, loop, jobs.max, preloadSandbox),
+	        jobs.max),
+	    configFiles(std::move(configs)),
+	    useGraphCache(useCache),
+	    eagerBuild(eagerMode)
 	{
+		graph.productMgr.SetAccessLog(&accessLog);
+		graph.productMgr.SetDepsLog(&depsLog);
+		graph.productMgr.SetJobHistory(&jobHistory);
+		jobManager.SetJobHistory(&jobHistory);
+
+		jobServer = JobServer::Connect(loop);
+		if (!jobServer)
+			jobServer = JobServer::Create(loop, jobs.max, jobs.jobServerFifo);
+		jobManager.SetJobServer(jobServer.get());
+
+		if (jobs.adaptive) {
+			loadMonitor = std::make_unique<LoadMonitor>(loop, jobManager,
+			    jobs.min, jobs.max);
+		}
+
+		if (contentDigests) {
+			digestDb = std::make_unique<DigestDatabase>(GetStateFilePath("digests.db"));
+			graph.productMgr.SetDigestDatabase(digestDb.get());
+		}
+	}
+
+	void SetStatCache(StatCache * cache)
+	{
+		graph.productMgr.SetStatCache(cache);
 	}
 
 	int Run(const std::unordered_set<std::string_view> &targets);
 };
 
+void
+Main::RunScript(Interpreter & interp, const std::string & path, const ConfigNode & config)
+{
+	graphCache.AddScript(path);
+	interp.RunFile(path, config);
+}
+
 void
 Main::IncludeScript(Interpreter & interp, const IncludeFile & file)
 {
@@ -88,7 +263,7 @@ Main::IncludeScript(Interpreter & interp, const IncludeFile & file)
 		errx(1, "Cannot include multiple scripts at once.");
 	}
 
-	interp.RunFile(file.paths.front(), *file.config);
+	RunScript(interp, file.paths.front(), *file.config);
 }
 
 void
@@ -97,6 +272,7 @@ Main::IncludeConfig(Interpreter & interp, const IncludeFile & file)
 	std::vector<ConfigNodePtr> configList;
 
 	for (const std::string & path : file.paths) {
+		graphCache.AddScript(path);
 		ConfigParser parser(path);
 
 		std::string errors;
@@ -110,28 +286,232 @@ Main::IncludeConfig(Interpreter & interp, const IncludeFile & file)
 	interp.ProcessConfig(*file.config, configList);
 }
 
-int
-Main::Run(const std::unordered_set<std::string_view> &targets)
+void
+Main::IncludeManifest(const IncludeFile & file)
+{
+
+	for (const std::string & path : file.paths) {
+		MappedFile manifest;
+		std::string errors;
+
+		graphCache.AddScript(path);
+		if (!manifest.Open(path))
+			err(1, "Could not open manifest %s", path.c_str());
+
+		bool parsed = ParseManifest(manifest.GetContents(),
+		    [this](ManifestCommand && command)
+		    {
+			graph.commandFactory.AddCommand(command.products,
+			    command.inputs, std::move(command.argList),
+			    std::move(command.options));
+		    }, errors);
+		if (!parsed) {
+			errx(1, "Could not parse manifest %s: %s",
+			    path.c_str(), errors.c_str());
+		}
+	}
+}
+
+void
+Main::Include(Interpreter & interp, const IncludeFile & file)
+{
+
+	switch (file.type) {
+		case IncludeFile::Type::SCRIPT:
+			IncludeScript(interp, file);
+			break;
+		case IncludeFile::Type::CONFIG:
+			IncludeConfig(interp, file);
+			break;
+		case IncludeFile::Type::MANIFEST:
+			IncludeManifest(file);
+			break;
+	}
+}
+
+/*
+ * Evaluate everything that the scripts have included so far, except for
+ * the includes that declared what they provide, which are deferred.
+ */
+void
+Main::EvaluateIncludes(Interpreter & interp, const std::string & configuration)
 {
-	interp.RunFile("/home/rstone/repos/factory/src/lua_lib/basic.lua", ConfigNode(ConfigNodeList{}));
-	interp.RunFile("factory.lua", ConfigNode(ConfigNodeList{}));
 
 	while (true) {
+		if (eager)
+			eager->Update();
+
 		std::optional<IncludeFile> file = interp.GetNextInclude();
 		if (!file.has_value())
 			break;
 
-		switch (file->type) {
-			case IncludeFile::Type::SCRIPT:
-				IncludeScript(interp, *file);
-				break;
-			case IncludeFile::Type::CONFIG:
-				IncludeConfig(interp, *file);
-				break;
+		if (file->IsLazy()) {
+			deferred.emplace_back(interp, configuration, std::move(*file));
+			continue;
+		}
+
+		Include(interp, *file);
+	}
+}
+
+void
+Main::EvaluateScripts(Interpreter & interp, const std::string & configuration)
+{
+	RunScript(interp, "/home/rstone/repos/factory/src/lua_lib/basic.lua", ConfigNode(ConfigNodeList{}));
+	RunScript(interp, "factory.lua", ConfigNode(ConfigNodeList{}));
+
+	EvaluateIncludes(interp, configuration);
+}
+
+/*
+ * A deferred include is needed if it provides one of the targets, or if it
+ * might make a path that the targets need and that nothing makes yet: a
+ * path under one of its output directories, or a directory input that its
+ * outputs are under.
+ */
+bool
+Main::IncludeNeeded(const DeferredInclude & include,
+    const std::unordered_set<std::string_view> &targets,
+    const std::vector<Path> & inputs, const std::vector<Path> & parents)
+{
+
+	for (const std::string & target : include.file.targets) {
+		if (targets.count(target))
+			return true;
+		if (!include.configuration.empty() &&
+		    targets.count(include.configuration + ":" + target))
+			return true;
+	}
+
+	for (const Path & dir : include.file.outputs) {
+		for (const Path & input : inputs) {
+			if (PathIsUnder(input, dir) || PathIsUnder(dir, input))
+				return true;
+		}
+
+		for (const Path & parent : parents) {
+			if (PathIsUnder(parent, dir))
+				return true;
 		}
 	}
 
-	productMgr.SubmitLeafJobs(targets);
+	return false;
+}
+
+/*
+ * Evaluate the deferred includes that the targets need.  They can add
+ * inputs and includes of their own, so repeat until no more are needed.
+ */
+void
+Main::EvaluateDeferred(const std::unordered_set<std::string_view> &targets)
+{
+
+	while (!deferred.empty()) {
+		std::vector<Path> inputs, parents;
+		std::list<DeferredInclude> needed;
+
+		graph.productMgr.FindUnmadeInputs(targets, inputs, parents);
+
+		auto it = deferred.begin();
+		while (it != deferred.end()) {
+			auto next = std::next(it);
+			if (IncludeNeeded(*it, targets, inputs, parents))
+				needed.splice(needed.end(), deferred, it);
+			it = next;
+		}
+
+		if (needed.empty())
+			break;
+
+		for (DeferredInclude & include : needed) {
+			graph.commandFactory.SetConfiguration(include.configuration);
+			Include(include.interp, include.file);
+			EvaluateIncludes(include.interp, include.configuration);
+		}
+	}
+
+	graph.commandFactory.SetConfiguration("");
+}
+
+/*
+ * Every configuration gets its own Lua state, but they all add commands to
+ * the same graph, so everything is built by one set of jobs.  Returns false
+ * if some includes weren't needed for the targets, and so the graph isn't
+ * complete.
+ */
+bool
+Main::EvaluateConfigurations(const std::unordered_set<std::string_view> &targets)
+{
+	std::vector<std::unique_ptr<Interpreter>> interpreters;
+
+	if (configFiles.empty()) {
+		interpreters.push_back(std::make_unique<Interpreter>(graph.commandFactory));
+		EvaluateScripts(*interpreters.back(), "");
+	}
+
+	for (const Path & path : configFiles) {
+		std::string name = path.stem().string();
+		ConfigParser parser(path);
+		std::string errors;
+
+		graphCache.AddScript(path.string());
+		if (!parser.Parse(errors)) {
+			errx(1, "Could not parse configuration %s: %s",
+			    path.c_str(), errors.c_str());
+		}
+
+		interpreters.push_back(std::make_unique<Interpreter>(graph.commandFactory));
+		Interpreter & interp = *interpreters.back();
+		interp.SetConfiguration(name, parser.GetConfig());
+		graph.commandFactory.SetConfiguration(name);
+		EvaluateScripts(interp, name);
+	}
+
+	graph.commandFactory.SetConfiguration("");
+	EvaluateDeferred(targets);
+
+	bool complete = deferred.empty();
+	deferred.clear();
+	return complete;
+}
+
+int
+Main::Run(const std::unordered_set<std::string_view> &targets)
+{
+	graphCache.SetConfigurations(ConfigurationNames(configFiles));
+
+	if (!evaluated &&
+	    (!useGraphCache || !graphCache.Load(graph.commandFactory))) {
+		if (eagerBuild) {
+			eager = std::make_unique<EagerBuilder>(loop, jobManager,
+			    graph.productMgr, targets);
+			graph.commandFactory.SetListener(eager.get());
+		}
+
+		bool complete = EvaluateConfigurations(targets);
+
+		/*
+		 * Scripts that weren't needed may hold the command reading a
+		 * stream, so only a complete graph can be checked.
+		 */
+		if (complete)
+			graph.commandFactory.CheckStreams();
+
+		if (eager) {
+			eager->Finish();
+			graph.commandFactory.SetListener(nullptr);
+			eager.reset();
+		}
+
+		/*
+		 * A graph that left out includes can't be used for other
+		 * targets.
+		 */
+		if (useGraphCache && complete)
+			graphCache.Save();
+	}
+
+	graph.productMgr.SubmitLeafJobs(targets);
 
 	if (!jobManager.ScheduleJob()) {
 		printf("No work to build target\n");
@@ -140,7 +520,7 @@ Main::Run(const std::unordered_set<std::string_view> &targets)
 
 	loop.Run();
 
-	productMgr.CheckBlockedCommands();
+	graph.productMgr.CheckBlockedCommands();
 
 	return (0);
 }
@@ -152,40 +532,206 @@ Main::Run(const std::unordered_set<std::string_view> &targets)
  */
 std::unique_ptr<Main> mainObj;
 
-int main(int argc, char **argv)
+/*
+ * The graph that a daemon keeps between builds.  Each build runs in a child
+ * process, which gets its own copy of the graph to schedule.
+ */
+class ResidentGraph : public DaemonBuilder
+{
+	JobLimit jobLimit;
+	bool contentDigests;
+	bool preloadSandbox;
+	std::vector<Path> configFiles;
+	std::unique_ptr<GraphCache> graphCache;
+	std::unique_ptr<BuildGraph> graph;
+
+public:
+	ResidentGraph(const JobLimit & jobs, bool digests, bool preload,
+	    std::vector<Path> && configs)
+	  : jobLimit(jobs),
+	    contentDigests(digests),
+	    preloadSandbox(preload),
+	    configFiles(std::move(configs))
+	{
+	}
+
+	bool LoadGraph(std::vector<Path> & scripts) override
+	{
+		graphCache = std::make_unique<GraphCache>(GetStateFilePath("graph.cache"));
+		graphCache->SetConfigurations(ConfigurationNames(configFiles));
+		graph = std::make_unique<BuildGraph>(graphCache.get());
+
+		if (!graphCache->Load(graph->commandFactory)) {
+			DropGraph();
+			return false;
+		}
+
+		scripts = graphCache->GetScripts();
+		return true;
+	}
+
+	bool GraphIsCurrent() override
+	{
+
+		return graphCache->IsCurrent();
+	}
+
+	void DropGraph() override
+	{
+		graph.reset();
+		graphCache.reset();
+	}
+
+	int Build(const std::vector<std::string> & targets, StatCache & stats) override
+	{
+		std::unordered_set<std::string_view> targetSet(targets.begin(),
+		    targets.end());
+
+		mainObj = std::make_unique<Main>(jobLimit, true, contentDigests,
+		    preloadSandbox, false, std::vector<Path>(configFiles),
+		    graph.get());
+		mainObj->SetStatCache(&stats);
+		return mainObj->Run(targetSet);
+	}
+};
+
+static int
+RunDaemon(const JobLimit & jobs, bool contentDigests, bool preloadSandbox,
+    std::vector<Path> && configs)
+{
+	EventLoop loop;
+	ResidentGraph graph(jobs, contentDigests, preloadSandbox,
+	    std::move(configs));
+	BuildDaemon daemon(loop, GetStateFilePath(DAEMON_SOCKET), graph);
+
+	loop.Run();
+	return 0;
+}
+
+static bool
+ParseJobCount(const char * str, char ** endp, int & count)
+{
+	u_long jobs = strtoul(str, endp, 0);
+
+	if (*endp == str || jobs == 0 || jobs > std::numeric_limits<int>::max())
+		return false;
+
+	count = jobs;
+	return true;
+}
+
+/* Parse the argument to -j: <jobs>, auto or auto:<min>-<max>. */
+static bool
+ParseJobLimit(const char * arg, JobLimit & jobs)
 {
 	char *endp;
-	u_long maxJobs = 1;
+
+	if (strncmp(arg, "auto", 4) != 0) {
+		jobs.adaptive = false;
+		if (!ParseJobCount(arg, &endp, jobs.max) || *endp != '\0')
+			return false;
+		jobs.min = jobs.max;
+		return true;
+	}
+
+	jobs.adaptive = true;
+	jobs.min = 1;
+	jobs.max = LoadMonitor::DefaultMaxJobs();
+	if (arg[4] == '\0')
+		return true;
+
+	if (arg[4] != ':' || !ParseJobCount(arg + 5, &endp, jobs.min) ||
+	    *endp != '-' || !ParseJobCount(endp + 1, &endp, jobs.max) ||
+	    *endp != '\0')
+		return false;
+
+	return jobs.min <= jobs.max;
+}
+
+int main(int argc, char **argv)
+{
+	JobLimit jobs = {1, 1, false, false};
+	bool useGraphCache = true;
+	bool contentDigests = false;
+	bool runDaemon = false;
+	bool useDaemon = false;
+	bool eagerBuild = false;
+	bool preloadSandbox = false;
+	std::vector<Path> configs;
 	int ch;
 
 	if (elf_version(EV_CURRENT) == EV_NONE)
 		errx(1, "ELF library initialization failed: %s",
 		    elf_errmsg(-1));
 
-	while ((ch = getopt(argc, argv, "j:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:dDGHj:J:pP")) != -1) {
 		switch (ch) {
+		case 'c':
+			configs.emplace_back(optarg);
+			break;
+		case 'd':
+			runDaemon = true;
+			break;
+		case 'D':
+			useDaemon = true;
+			break;
+		case 'G':
+			useGraphCache = false;
+			break;
+		case 'H':
+			contentDigests = true;
+			break;
 		case 'j':
-			maxJobs = strtoul(optarg, &endp, 0);
-			if (optarg[0] == '\0' || *endp != '\0' ||
-			    maxJobs == 0 || maxJobs > std::numeric_limits<int>::max()) {
-				errx(1, "-j <jobs> parameter must be a positive int");
+			if (!ParseJobLimit(optarg, jobs)) {
+				errx(1, "-j parameter must be a positive int, auto or auto:<min>-<max>");
 			}
 			break;
+		case 'J':
+			if (strcmp(optarg, "fifo") == 0)
+				jobs.jobServerFifo = true;
+			else if (strcmp(optarg, "pipe") == 0)
+				jobs.jobServerFifo = false;
+			else
+				errx(1, "-J parameter must be fifo or pipe");
+			break;
+		case 'p':
+			eagerBuild = true;
+			break;
+		case 'P':
+			preloadSandbox = true;
+			break;
 		}
 	}
 
 	argv += optind;
 	argc -= optind;
 
+	if (runDaemon) {
+		if (argc != 0)
+			errx(1, "-d does not take any targets");
+		if (!useGraphCache)
+			errx(1, "-d requires the graph cache");
+
+		return RunDaemon(jobs, contentDigests, preloadSandbox,
+		    std::move(configs));
+	}
+
 	if (argc == 0) {
 		errx(1, "No targets specified");
 	}
 
+	if (useDaemon) {
+		std::vector<std::string> names(argv, argv + argc);
+
+		return RunDaemonClient(GetStateFilePath(DAEMON_SOCKET), names);
+	}
+
 	std::unordered_set<std::string_view> targets;
 	for (int i = 0; i < argc; ++i) {
 		targets.insert(argv[i]);
 	}
 
-	mainObj = std::make_unique<Main>(maxJobs);
+	mainObj = std::make_unique<Main>(jobs, useGraphCache, contentDigests,
+	    preloadSandbox, eagerBuild, std::move(configs));
 	return mainObj->Run(targets);
 }
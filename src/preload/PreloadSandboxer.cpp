@@ -42,10 +42,12 @@
 
 static char ld_preload[] = "LD_PRELOAD=" LIB_LOCATION;
 
-PreloadSandboxer::PreloadSandboxer(uint64_t jobId, const Command & c, const TempFile *msgSock)
+PreloadSandboxer::PreloadSandboxer(uint64_t jobId, Command & c, const TempFile *msgSock)
   : command(c),
     shm(msgSock, jobId)
 {
+	command.TrackAccesses();
+
 	exec_fd = open(c.GetExecutable().c_str(), O_RDONLY | O_EXEC);
 	if (exec_fd < 0) {
 		err(1, "Could not open '%s' for exec", c.GetExecutable().c_str());
@@ -117,6 +119,11 @@ PreloadSandboxer::HandleMessage(MsgSocket * sock, const SandboxMsg & msg)
 	int permitted = perms.IsPermitted(workdir, path, msg.open.flags & O_ACCMODE);
 	if (permitted != 0) {
 		fprintf(stderr, "Denied access to '%s' for %x\n", path.c_str(), msg.open.flags & O_ACCMODE);
+	} else if ((msg.open.flags & O_ACCMODE) != O_WRONLY) {
+		/* Remember what was read so we can narrow directory inputs. */
+		if (path.is_relative())
+			path = (workdir / path).lexically_normal();
+		command.AddAccess(std::move(path));
 	}
 
 	SendResponse(sock, permitted);
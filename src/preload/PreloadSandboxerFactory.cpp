@@ -46,7 +46,7 @@ PreloadSandboxerFactory::~PreloadSandboxerFactory()
 }
 
 Sandbox &
-PreloadSandboxerFactory::MakeSandbox(uint64_t jid, const Command &command)
+PreloadSandboxerFactory::MakeSandbox(uint64_t jid, Command &command)
 {
 	auto [it, inserted] = jobMap.emplace(jid, std::make_unique<PreloadSandboxer>(jid, command, server.GetSock()));
 
@@ -0,0 +1,128 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "AccessLog.h"
+
+#include "StateFile.h"
+
+#include <err.h>
+
+#define ACCESS_LOG_MAGIC	0x46414c00 /* "FAL\0" */
+#define ACCESS_LOG_VERSION	1
+
+AccessLog::AccessLog(Path path)
+  : logPath(std::move(path)),
+    dirty(false)
+{
+	Load();
+}
+
+AccessLog::~AccessLog()
+{
+	Save();
+}
+
+void
+AccessLog::Load()
+{
+	StateFileReader reader;
+
+	if (!reader.Open(logPath, ACCESS_LOG_MAGIC, ACCESS_LOG_VERSION))
+		return;
+
+	CommandMap loaded;
+	uint32_t numCommands = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numCommands && !reader.Failed(); ++i) {
+		AccessSet & accesses = loaded[std::string(reader.ReadString())];
+
+		uint32_t numAccesses = reader.Read<uint32_t>();
+		for (uint32_t j = 0; j < numAccesses && !reader.Failed(); ++j) {
+			accesses.emplace(reader.ReadString());
+		}
+	}
+
+	if (reader.Failed() || !reader.AtEnd()) {
+		warnx("Ignoring corrupt access log '%s'", logPath.c_str());
+		return;
+	}
+
+	commands = std::move(loaded);
+}
+
+void
+AccessLog::Save()
+{
+	if (!dirty)
+		return;
+
+	StateFileWriter writer(ACCESS_LOG_MAGIC, ACCESS_LOG_VERSION);
+
+	writer.Write(static_cast<uint32_t>(commands.size()));
+	for (const auto & [product, accesses] : commands) {
+		writer.WriteString(product);
+		writer.Write(static_cast<uint32_t>(accesses.size()));
+		for (const std::string & path : accesses) {
+			writer.WriteString(path);
+		}
+	}
+
+	if (!writer.Commit(logPath))
+		warn("Could not write access log '%s'", logPath.c_str());
+
+	dirty = false;
+}
+
+const AccessLog::AccessSet *
+AccessLog::Lookup(const Path & product) const
+{
+	auto it = commands.find(product.string());
+	if (it == commands.end())
+		return nullptr;
+
+	return &it->second;
+}
+
+void
+AccessLog::Record(const Path & product, const std::vector<Path> & accesses)
+{
+	AccessSet record;
+
+	for (const Path & path : accesses) {
+		record.insert(path.string());
+	}
+
+	commands[product.string()] = std::move(record);
+	dirty = true;
+}
+
+void
+AccessLog::Forget(const Path & product)
+{
+	if (commands.erase(product.string()) != 0)
+		dirty = true;
+}
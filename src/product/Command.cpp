@@ -40,7 +40,17 @@ Command::Command(ProductList && productList, ArgList && a, PermissionList && per
     workdir(std::move(wd)),
     stdin(std::move(in)),
     stdout(std::move(out)),
-    queued(false)
+    queued(false),
+    restat(false),
+    ephemeral(false),
+    jobServer(false),
+    accessesTracked(false),
+    downstream(nullptr),
+    criticalPath(0),
+    fanOut(0),
+    pool(nullptr),
+    cpus(1),
+    memory(0)
 {
 	for (Product * p : products) {
 		p->SetCommand(this);
@@ -29,21 +29,32 @@
 #include "CommandFactory.h"
 
 #include "Command.h"
+#include "Digest.h"
+#include "GraphCache.h"
+#include "JobServer.h"
 #include "PermissionList.h"
 #include "Product.h"
 #include "ProductManager.h"
+#include "ResourcePool.h"
+#include "StateFile.h"
 
 #include <err.h>
 #include <paths.h>
 #include <unistd.h>
 
-CommandFactory::CommandFactory(ProductManager &p)
+CommandFactory::CommandFactory(ProductManager &p, GraphCache * cache)
   : productManager(p),
+    graphCache(cache),
+    listener(nullptr),
     factoryWorkDir(std::filesystem::current_path()),
     shellPath(GetShellPath())
 {
 }
 
+CommandFactory::~CommandFactory()
+{
+}
+
 std::vector<Path>
 CommandFactory::GetShellPath()
 {
@@ -96,7 +107,7 @@ CommandFactory::AddCommand(const std::vector<std::string> & productList,
 	Path workdir;
 
 	if (options.workdir)
-		workdir = std::move(*options.workdir);
+		workdir = *options.workdir;
 	else
 		workdir = factoryWorkDir;
 
@@ -106,12 +117,40 @@ CommandFactory::AddCommand(const std::vector<std::string> & productList,
 
 	argList.front() = exePath.string();
 
+	/*
+	 * Record the command with its executable already resolved, so that
+	 * replaying it from the cache doesn't need to search the PATH again.
+	 */
+	if (graphCache)
+		graphCache->RecordCommand(productList, inputPaths, argList, options,
+		    configuration);
+
+	std::vector<Path> productPaths;
+	for (Path path : productList) {
+		if (path.is_relative()) {
+			path = workdir / path;
+		}
+		productPaths.push_back(std::move(path));
+	}
+
+	uint64_t definition = DigestDefinition(productPaths, inputPaths, argList,
+	    workdir, options);
+	if (IsSharedCommand(productPaths, argList, workdir, definition,
+	    options.targetList)) {
+		/* The first definition already took its input from the stream. */
+		if (options.stdin)
+			streams.erase(options.stdin->is_relative() ?
+			    workdir / *options.stdin : *options.stdin);
+		return;
+	}
+
 	permList.AddPermission(exe->GetPath(), Permission::READ | Permission::EXEC);
 
 	for (Path path : inputPaths) {
 		if (path.is_relative()) {
 			path = workdir / path;
 		}
+		CheckNotStreamed(path, argList.front());
 		Product * input = productManager.GetProduct(path, false);
 		permList.AddPermission(input->GetPath(), Permission::READ | Permission::EXEC);
 		inputs.push_back(input);
@@ -121,6 +160,7 @@ CommandFactory::AddCommand(const std::vector<std::string> & productList,
 		if (path.is_relative()) {
 			path = workdir / path;
 		}
+		CheckNotStreamed(path, argList.front());
 		Product * input = productManager.GetProduct(path, false);
 		inputs.push_back(input);
 	}
@@ -139,22 +179,304 @@ CommandFactory::AddCommand(const std::vector<std::string> & productList,
 		permList.AddPermission(path, Permission::STAT);
 	}
 
-	for (Path path : productList) {
-		if (path.is_relative()) {
-			path = workdir / path;
+	std::optional<Path> depfile;
+	if (options.depfile) {
+		depfile = *options.depfile;
+		if (depfile->is_relative()) {
+			depfile = workdir / *depfile;
+		}
+		permList.AddPermission(*depfile, Permission::READ | Permission::WRITE);
+	}
+
+	/* In case the jobserver is a FIFO. */
+	if (options.jobserver)
+		permList.AddPermission(MakeAbsolute(GetStateFilePath(JOBSERVER_FIFO)),
+		    Permission::READ | Permission::WRITE);
+
+	ResourcePool * pool = nullptr;
+	if (!options.pool.empty())
+		pool = FindPool(options.pool, argList.front());
+
+	std::optional<Path> stdin = std::move(options.stdin);
+	std::unique_ptr<Command> upstream;
+	if (stdin) {
+		Path path = stdin->is_relative() ? workdir / *stdin : *stdin;
+		auto it = streams.find(path);
+		if (it != streams.end()) {
+			upstream = std::move(it->second.command);
+			inputs.insert(inputs.end(), it->second.inputs.begin(),
+			    it->second.inputs.end());
+			streams.erase(it);
+			stdin.reset();
+		} else if (streamed.count(path)) {
+			errx(1, "'%s' is streamed into another command and can't be the stdin of '%s'",
+			    path.c_str(), argList.front().c_str());
 		}
+	}
+
+	if (options.stream) {
+		if (!options.stdout || productPaths.size() != 1 ||
+		    productPaths.front() != (options.stdout->is_relative() ?
+		    workdir / *options.stdout : *options.stdout)) {
+			errx(1, "The only product of streaming command '%s' must be its stdout",
+			    argList.front().c_str());
+		}
+		if (depfile)
+			errx(1, "Streaming command '%s' can't have a depfile",
+			    argList.front().c_str());
+		if (!options.targetList.empty())
+			errx(1, "Streaming command '%s' can't be in a target; list the command that reads it instead",
+			    argList.front().c_str());
+
+		streamed.insert(productPaths.front());
+
+		PendingStream & stream = streams[productPaths.front()];
+		stream.command = std::make_unique<Command>(ProductList(),
+		    std::move(argList), std::move(permList), std::move(workdir),
+		    std::move(stdin), std::nullopt);
+		if (upstream)
+			stream.command->SetUpstream(std::move(upstream));
+		stream.command->SetJobServer(options.jobserver);
+		stream.command->SetResources(pool, options.cpus, options.memory);
+		stream.inputs = std::move(inputs);
+		stream.definition = definition;
+		return;
+	}
 
+	for (const Path & path : productPaths) {
 		Product * product = productManager.GetProduct(path);
 		permList.AddPermission(product->GetPath(), Permission::READ | Permission::WRITE);
 		products.push_back(product);
 		productManager.SetInputs(product, inputs);
+	}
+
+	AddToTargets(products, options.targetList);
+
+	commandList.emplace_back(std::make_unique<Command>(std::move(products), std::move(argList),
+	    std::move(permList), std::move(workdir), std::move(stdin),
+	    std::move(options.stdout)));
+	if (upstream)
+		commandList.back()->SetUpstream(std::move(upstream));
+	commandList.back()->SetRestat(options.restat);
+	commandList.back()->SetEphemeral(options.ephemeral);
+	commandList.back()->SetJobServer(options.jobserver);
+	commandList.back()->SetDepfile(std::move(depfile));
+	commandList.back()->SetResources(pool, options.cpus, options.memory);
+	definitions[commandList.back().get()] = {definition, configuration};
+
+	if (listener)
+		listener->CommandAdded(commandList.back().get(), inputs);
+}
+
+/*
+ * A streamed path never exists as a file, so a command can only read it
+ * as its stdin.
+ */
+void
+CommandFactory::CheckNotStreamed(const Path & path, const std::string & command) const
+{
+
+	if (streamed.count(path))
+		errx(1, "'%s' is streamed into the command that reads it as stdin and can't be an input of '%s'",
+		    path.c_str(), command.c_str());
+}
 
-		for (auto target : options.targetList) {
+void
+CommandFactory::CheckStreams() const
+{
+
+	for (const auto & [path, stream] : streams) {
+		errx(1, "Nothing reads '%s', which '%s' streams to",
+		    path.c_str(), stream.command->GetArgList().front().c_str());
+	}
+}
+
+void
+CommandFactory::AddToTargets(const std::vector<Product*> & products,
+    const std::vector<std::string> & targets)
+{
+	for (Product * product : products) {
+		for (const std::string & target : targets) {
 			productManager.AddToTarget(target, product);
+			if (!configuration.empty())
+				productManager.AddToTarget(configuration + ":" + target, product);
 		}
 	}
+}
 
-	commandList.emplace_back(std::make_unique<Command>(std::move(products), std::move(argList),
-	    std::move(permList), std::move(workdir), std::move(options.stdin),
-	    std::move(options.stdout)));
+static void
+DigestString(uint64_t & digest, const std::string & str)
+{
+	uint64_t len = str.size();
+
+	digest = DigestBuffer(&len, sizeof(len), digest);
+	digest = DigestBuffer(str.data(), str.size(), digest);
+}
+
+/*
+ * Digest everything that defines a command, except for the targets that it
+ * is in, including the definition of any command that streams into it.
+ */
+uint64_t
+CommandFactory::DigestDefinition(const std::vector<Path> & productPaths,
+    const std::vector<std::string> & inputPaths,
+    const std::vector<std::string> & argList, const Path & workdir,
+    const CommandOptions & options) const
+{
+	uint64_t digest = 0;
+
+	auto digestPath = [&digest, &workdir] (const Path & path) {
+		DigestString(digest, (path.is_relative() ? workdir / path : path).string());
+	};
+	auto digestPaths = [&digest, &digestPath] (const auto & list) {
+		uint64_t count = list.size();
+		digest = DigestBuffer(&count, sizeof(count), digest);
+		for (const auto & path : list)
+			digestPath(Path(path));
+	};
+	auto digestOptional = [&digest, &digestPath] (const std::optional<Path> & path) {
+		bool set = path.has_value();
+		digest = DigestBuffer(&set, sizeof(set), digest);
+		if (set)
+			digestPath(*path);
+	};
+
+	digestPaths(productPaths);
+	digestPaths(inputPaths);
+	digestPaths(options.orderDeps);
+	digestPaths(options.tmpdirs);
+	digestPaths(options.statdirs);
+	for (const std::string & arg : argList)
+		DigestString(digest, arg);
+	DigestString(digest, workdir.string());
+	digestOptional(options.stdin);
+	digestOptional(options.stdout);
+	digestOptional(options.depfile);
+	DigestString(digest, options.pool);
+
+	uint64_t values[] = {
+		options.restat, options.ephemeral, options.stream,
+		options.jobserver, options.cpus, options.memory,
+	};
+	digest = DigestBuffer(values, sizeof(values), digest);
+
+	if (options.stdin) {
+		auto it = streams.find(options.stdin->is_relative() ?
+		    workdir / *options.stdin : *options.stdin);
+		if (it != streams.end())
+			digest = DigestBuffer(&it->second.definition,
+			    sizeof(it->second.definition), digest);
+	}
+
+	return digest;
+}
+
+/*
+ * When building several configurations, a command that doesn't depend on
+ * the configuration is defined once by each of them.  Only the first
+ * definition is kept, so it runs once; but a product can't be made by two
+ * different commands, and every configuration must define the command in
+ * the same way.
+ */
+bool
+CommandFactory::IsSharedCommand(const std::vector<Path> & productPaths,
+    const std::vector<std::string> & argList, const Path & workdir,
+    uint64_t definition, const std::vector<std::string> & targets)
+{
+	Command * existing = nullptr;
+
+	for (const Path & path : productPaths) {
+		Product * product = productManager.FindProduct(path);
+		if (product && product->GetCommand()) {
+			existing = product->GetCommand();
+			break;
+		}
+	}
+
+	if (!existing)
+		return false;
+
+	bool same = existing->GetArgList() == argList &&
+	    existing->GetWorkDir() == workdir &&
+	    existing->GetProducts().size() == productPaths.size();
+	for (size_t i = 0; same && i < productPaths.size(); ++i) {
+		same = existing->GetProducts()[i] == productManager.FindProduct(productPaths[i]);
+	}
+
+	if (!same) {
+		errx(1, "Product '%s' is defined by more than one command",
+		    existing->GetProducts().front()->GetPath().c_str());
+	}
+
+	const Definition & first = definitions.at(existing);
+	if (first.digest != definition) {
+		if (first.configuration == configuration)
+			errx(1, "Product '%s' is defined by more than one command",
+			    existing->GetProducts().front()->GetPath().c_str());
+		errx(1, "Configurations '%s' and '%s' define the command for '%s' differently",
+		    first.configuration.c_str(), configuration.c_str(),
+		    existing->GetProducts().front()->GetPath().c_str());
+	}
+
+	AddToTargets(existing->GetProducts(), targets);
+	return true;
+}
+
+void
+CommandFactory::AddInputRoot(const std::string & rootPath,
+    const std::optional<Path> & stamp)
+{
+	Path path(rootPath);
+
+	if (graphCache)
+		graphCache->RecordInputRoot(rootPath, stamp);
+
+	if (path.is_relative()) {
+		path = factoryWorkDir / path;
+	}
+
+	Path fingerprint;
+	if (stamp) {
+		fingerprint = *stamp;
+		if (fingerprint.is_relative()) {
+			fingerprint = factoryWorkDir / fingerprint;
+		}
+	} else {
+		fingerprint = path;
+	}
+
+	productManager.AddInputRoot(path, fingerprint);
+}
+
+void
+CommandFactory::AddPool(const std::string & name, uint32_t depth)
+{
+
+	if (graphCache)
+		graphCache->RecordPool(name, depth);
+
+	if (depth == 0)
+		errx(1, "Pool '%s' must have a depth of at least 1", name.c_str());
+
+	/* Every configuration may define the same pool. */
+	auto [it, inserted] = pools.try_emplace(name);
+	if (!inserted) {
+		if (it->second->GetDepth() != depth)
+			errx(1, "Pool '%s' is defined with different depths",
+			    name.c_str());
+		return;
+	}
+
+	it->second = std::make_unique<ResourcePool>(name, depth);
+}
+
+ResourcePool *
+CommandFactory::FindPool(const std::string & name, const std::string & command) const
+{
+	auto it = pools.find(name);
+	if (it == pools.end())
+		errx(1, "Command '%s' uses undefined pool '%s'", command.c_str(),
+		    name.c_str());
+
+	return it->second.get();
 }
@@ -0,0 +1,239 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DepGraph.h"
+
+#include "Product.h"
+
+#include <algorithm>
+
+DepGraph::DepGraph()
+  : frozen(false)
+{
+}
+
+void
+DepGraph::AddEdge(Product * product, Product * input)
+{
+
+	edges.emplace_back(product, input);
+}
+
+void
+DepGraph::SortEdges()
+{
+	auto byProduct = [](const Edge & a, const Edge & b)
+	{
+		return std::less<Product*>()(a.first, b.first);
+	};
+
+	std::sort(edges.begin(), edges.end(), byProduct);
+}
+
+void
+DepGraph::Freeze(const std::vector<Product*> & nodeList)
+{
+	size_t numNodes = nodeList.size();
+
+	nodes = nodeList;
+
+	edges.erase(std::remove_if(edges.begin(), edges.end(),
+	    [](const Edge & edge) { return edge.first == edge.second; }),
+	    edges.end());
+
+	/* Order by product index so that each product's inputs are adjacent. */
+	auto byProduct = [](const Edge & a, const Edge & b)
+	{
+		uint32_t aProduct = a.first->GetGraphIndex();
+		uint32_t bProduct = b.first->GetGraphIndex();
+
+		if (aProduct != bProduct)
+			return aProduct < bProduct;
+		return a.second->GetGraphIndex() < b.second->GetGraphIndex();
+	};
+	std::sort(edges.begin(), edges.end(), byProduct);
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	inputOffsets.assign(numNodes + 1, 0);
+	dependeeOffsets.assign(numNodes + 1, 0);
+	for (const Edge & edge : edges) {
+		inputOffsets[edge.first->GetGraphIndex() + 1]++;
+		dependeeOffsets[edge.second->GetGraphIndex() + 1]++;
+	}
+
+	for (size_t i = 0; i < numNodes; ++i) {
+		inputOffsets[i + 1] += inputOffsets[i];
+		dependeeOffsets[i + 1] += dependeeOffsets[i];
+	}
+
+	inputs.resize(edges.size());
+	dependees.resize(edges.size());
+
+	/* Edges are sorted by product, so inputs fill in order. */
+	std::vector<uint32_t> dependeeFill(dependeeOffsets.begin(),
+	    dependeeOffsets.end() - 1);
+	for (size_t i = 0; i < edges.size(); ++i) {
+		const Edge & edge = edges[i];
+
+		inputs[i] = edge.second;
+		dependees[dependeeFill[edge.second->GetGraphIndex()]++] = edge.first;
+	}
+
+	pending.reset(new std::atomic<uint32_t>[numNodes]);
+	for (size_t i = 0; i < numNodes; ++i) {
+		pending[i].store(UNSCHEDULED, std::memory_order_relaxed);
+	}
+
+	edges.clear();
+	edges.shrink_to_fit();
+	frozen = true;
+}
+
+DepGraph::Range
+DepGraph::Slice(const std::vector<uint32_t> & offsets,
+    const std::vector<Product*> & list, uint32_t node)
+{
+	return Range(list.data() + offsets[node], list.data() + offsets[node + 1]);
+}
+
+DepGraph::Range
+DepGraph::Inputs(uint32_t node) const
+{
+	if (!frozen || node == NO_NODE)
+		return Range(nullptr, nullptr);
+
+	return Slice(inputOffsets, inputs, node);
+}
+
+DepGraph::Range
+DepGraph::Dependees(uint32_t node) const
+{
+	if (!frozen || node == NO_NODE)
+		return Range(nullptr, nullptr);
+
+	return Slice(dependeeOffsets, dependees, node);
+}
+
+/*
+ * Tarjan's strongly connected components algorithm, with an explicit stack of
+ * the nodes being visited and how far we've gotten through their inputs.
+ * Every component with more than one node is a cycle; self-edges were
+ * dropped by Freeze().
+ */
+std::vector<std::vector<Product*>>
+DepGraph::FindCycles(const std::vector<Product*> & roots) const
+{
+	static const uint32_t UNVISITED = UINT32_MAX;
+
+	struct Frame
+	{
+		uint32_t node;
+		uint32_t nextInput;
+	};
+
+	std::vector<std::vector<Product*>> cycles;
+
+	if (!frozen)
+		return cycles;
+
+	size_t numNodes = nodes.size();
+	std::vector<uint32_t> index(numNodes, UNVISITED);
+	std::vector<uint32_t> lowLink(numNodes);
+	std::vector<bool> onStack(numNodes, false);
+	std::vector<uint32_t> componentStack;
+	std::vector<Frame> frames;
+	uint32_t nextIndex = 0;
+
+	auto visit = [&](uint32_t node)
+	{
+		index[node] = lowLink[node] = nextIndex++;
+		componentStack.push_back(node);
+		onStack[node] = true;
+		frames.push_back(Frame{node, inputOffsets[node]});
+	};
+
+	for (Product * root : roots) {
+		uint32_t rootNode = root->GetGraphIndex();
+
+		if (rootNode == NO_NODE || index[rootNode] != UNVISITED)
+			continue;
+
+		visit(rootNode);
+		while (!frames.empty()) {
+			Frame & frame = frames.back();
+			uint32_t node = frame.node;
+
+			if (frame.nextInput < inputOffsets[node + 1]) {
+				uint32_t input = inputs[frame.nextInput]->GetGraphIndex();
+				frame.nextInput++;
+
+				if (index[input] == UNVISITED)
+					visit(input);
+				else if (onStack[input])
+					lowLink[node] = std::min(lowLink[node], index[input]);
+				continue;
+			}
+
+			frames.pop_back();
+			if (!frames.empty()) {
+				uint32_t parent = frames.back().node;
+				lowLink[parent] = std::min(lowLink[parent], lowLink[node]);
+			}
+
+			if (lowLink[node] != index[node])
+				continue;
+
+			/* node is the root of a component; everything above it is in it. */
+			std::vector<Product*> component;
+			uint32_t member;
+			do {
+				member = componentStack.back();
+				componentStack.pop_back();
+				onStack[member] = false;
+				component.push_back(nodes[member]);
+			} while (member != node);
+
+			if (component.size() > 1)
+				cycles.push_back(std::move(component));
+		}
+	}
+
+	return cycles;
+}
+
+bool
+DepGraph::InputComplete(uint32_t node)
+{
+	uint32_t count = pending[node].load(std::memory_order_relaxed);
+
+	/* Products outside of the requested targets are never built. */
+	if (count == UNSCHEDULED || count == 0)
+		return false;
+
+	return pending[node].fetch_sub(1, std::memory_order_acq_rel) == 1;
+}
@@ -0,0 +1,199 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DepGraph.h"
+
+#include "JobQueue.h"
+#include "Product.h"
+#include "ProductManager.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+class DepGraphTestSuite : public ::testing::Test
+{
+protected:
+	JobQueue jobQueue;
+	ProductManager productManager;
+	std::vector<std::unique_ptr<Product>> products;
+	std::vector<Product*> nodes;
+	DepGraph graph;
+
+	DepGraphTestSuite()
+	  : productManager(jobQueue)
+	{
+	}
+
+	void MakeNodes(size_t count)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			products.push_back(std::make_unique<Product>(i, productManager));
+			products.back()->SetGraphIndex(i);
+			nodes.push_back(products.back().get());
+		}
+	}
+
+	void AddEdge(uint32_t product, uint32_t input)
+	{
+		graph.AddEdge(nodes[product], nodes[input]);
+	}
+
+	static std::vector<uint32_t> Indices(DepGraph::Range range)
+	{
+		std::vector<uint32_t> indices;
+
+		for (Product * p : range) {
+			indices.push_back(p->GetGraphIndex());
+		}
+		std::sort(indices.begin(), indices.end());
+		return indices;
+	}
+
+	static std::vector<uint32_t> Indices(const std::vector<Product*> & list)
+	{
+		return Indices(DepGraph::Range(list.data(), list.data() + list.size()));
+	}
+};
+
+typedef std::vector<uint32_t> IndexList;
+
+TEST_F(DepGraphTestSuite, TestFreeze)
+{
+	MakeNodes(4);
+	AddEdge(0, 2);
+	AddEdge(0, 1);
+	AddEdge(1, 2);
+	AddEdge(3, 0);
+	graph.Freeze(nodes);
+
+	ASSERT_TRUE(graph.IsFrozen());
+	EXPECT_EQ(Indices(graph.Inputs(0)), IndexList({1, 2}));
+	EXPECT_EQ(Indices(graph.Inputs(1)), IndexList({2}));
+	EXPECT_EQ(Indices(graph.Inputs(2)), IndexList());
+	EXPECT_EQ(Indices(graph.Inputs(3)), IndexList({0}));
+
+	EXPECT_EQ(Indices(graph.Dependees(0)), IndexList({3}));
+	EXPECT_EQ(Indices(graph.Dependees(2)), IndexList({0, 1}));
+	EXPECT_EQ(Indices(graph.Dependees(3)), IndexList());
+
+	EXPECT_TRUE(graph.Inputs(DepGraph::NO_NODE).empty());
+}
+
+TEST_F(DepGraphTestSuite, TestDuplicateAndSelfEdges)
+{
+	MakeNodes(3);
+	AddEdge(0, 1);
+	AddEdge(0, 1);
+	AddEdge(0, 0);
+	AddEdge(2, 1);
+	AddEdge(0, 1);
+	AddEdge(2, 2);
+	graph.Freeze(nodes);
+
+	EXPECT_EQ(Indices(graph.Inputs(0)), IndexList({1}));
+	EXPECT_EQ(Indices(graph.Inputs(2)), IndexList({1}));
+	EXPECT_EQ(Indices(graph.Dependees(1)), IndexList({0, 2}));
+	EXPECT_EQ(Indices(graph.Dependees(0)), IndexList());
+
+	/* A self-edge isn't a cycle. */
+	EXPECT_TRUE(graph.FindCycles({nodes[0], nodes[2]}).empty());
+}
+
+TEST_F(DepGraphTestSuite, TestPending)
+{
+	MakeNodes(3);
+	AddEdge(0, 1);
+	AddEdge(0, 2);
+	graph.Freeze(nodes);
+
+	EXPECT_EQ(graph.GetPending(0), DepGraph::UNSCHEDULED);
+	EXPECT_FALSE(graph.InputComplete(0));
+
+	graph.SetPending(0, 2);
+	EXPECT_FALSE(graph.InputComplete(0));
+	EXPECT_EQ(graph.GetPending(0), 1);
+	EXPECT_TRUE(graph.InputComplete(0));
+	EXPECT_EQ(graph.GetPending(0), 0);
+	EXPECT_FALSE(graph.InputComplete(0));
+}
+
+TEST_F(DepGraphTestSuite, TestDisjointCycles)
+{
+	/* 0 -> 1 -> 2 -> 0 and 3 -> 4 -> 3, joined by 5, and 6 -> 0. */
+	MakeNodes(7);
+	AddEdge(0, 1);
+	AddEdge(1, 2);
+	AddEdge(2, 0);
+	AddEdge(3, 4);
+	AddEdge(4, 3);
+	AddEdge(5, 0);
+	AddEdge(5, 3);
+	AddEdge(6, 0);
+	graph.Freeze(nodes);
+
+	auto cycles = graph.FindCycles({nodes[5], nodes[6]});
+	ASSERT_EQ(cycles.size(), 2);
+
+	std::vector<IndexList> found;
+	for (const auto & cycle : cycles) {
+		found.push_back(Indices(cycle));
+	}
+	std::sort(found.begin(), found.end());
+	EXPECT_EQ(found[0], IndexList({0, 1, 2}));
+	EXPECT_EQ(found[1], IndexList({3, 4}));
+
+	/* Only what is reachable from the roots is searched. */
+	EXPECT_TRUE(graph.FindCycles({nodes[6]}).size() == 1);
+}
+
+TEST_F(DepGraphTestSuite, TestDeepChain)
+{
+	const uint32_t length = 200000;
+
+	/* Far deeper than a recursive search could go. */
+	MakeNodes(length);
+	for (uint32_t i = 0; i + 1 < length; ++i) {
+		AddEdge(i, i + 1);
+	}
+	graph.Freeze(nodes);
+
+	EXPECT_TRUE(graph.FindCycles({nodes[0]}).empty());
+
+	DepGraph loop;
+	for (uint32_t i = 0; i < length; ++i) {
+		loop.AddEdge(nodes[i], nodes[(i + 1) % length]);
+	}
+	loop.Freeze(nodes);
+
+	auto cycles = loop.FindCycles({nodes[0]});
+	ASSERT_EQ(cycles.size(), 1);
+	EXPECT_EQ(cycles[0].size(), length);
+}
@@ -0,0 +1,201 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DepsLog.h"
+
+#include "StateFile.h"
+
+#include <err.h>
+
+#define DEPS_LOG_MAGIC		0x46444c00 /* "FDL\0" */
+#define DEPS_LOG_VERSION	1
+
+DepsLog::DepsLog(Path path)
+  : logPath(std::move(path)),
+    dirty(false)
+{
+	Load();
+}
+
+DepsLog::~DepsLog()
+{
+	Save();
+}
+
+uint32_t
+DepsLog::InternPath(const std::string & path)
+{
+	auto [it, inserted] = pathIds.emplace(path, paths.size());
+	if (inserted)
+		paths.push_back(path);
+
+	return it->second;
+}
+
+void
+DepsLog::Load()
+{
+	StateFileReader reader;
+
+	if (!reader.Open(logPath, DEPS_LOG_MAGIC, DEPS_LOG_VERSION))
+		return;
+
+	std::vector<std::string> loadedPaths;
+	uint32_t numPaths = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numPaths && !reader.Failed(); ++i) {
+		loadedPaths.emplace_back(reader.ReadString());
+	}
+
+	RecordMap loadedRecords;
+	uint32_t numRecords = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numRecords && !reader.Failed(); ++i) {
+		DepList & deps = loadedRecords[reader.Read<uint32_t>()];
+
+		uint32_t numDeps = reader.Read<uint32_t>();
+		for (uint32_t j = 0; j < numDeps && !reader.Failed(); ++j) {
+			deps.push_back(reader.Read<uint32_t>());
+		}
+	}
+
+	if (reader.Failed() || !reader.AtEnd()) {
+		warnx("Ignoring corrupt deps log '%s'", logPath.c_str());
+		return;
+	}
+
+	for (const auto & [product, deps] : loadedRecords) {
+		if (product >= loadedPaths.size()) {
+			warnx("Ignoring corrupt deps log '%s'", logPath.c_str());
+			return;
+		}
+
+		for (uint32_t dep : deps) {
+			if (dep >= loadedPaths.size()) {
+				warnx("Ignoring corrupt deps log '%s'", logPath.c_str());
+				return;
+			}
+		}
+	}
+
+	paths = std::move(loadedPaths);
+	for (uint32_t i = 0; i < paths.size(); ++i) {
+		pathIds.emplace(paths[i], i);
+	}
+	records = std::move(loadedRecords);
+}
+
+void
+DepsLog::Save()
+{
+	if (!dirty)
+		return;
+
+	/*
+	 * Paths that are no longer referenced by any record are dropped, so
+	 * the ids are reassigned as we go.
+	 */
+	std::vector<uint32_t> newIds(paths.size(), UINT32_MAX);
+	std::vector<uint32_t> order;
+	auto remap = [&newIds, &order](uint32_t id)
+		{
+			if (newIds[id] == UINT32_MAX) {
+				newIds[id] = order.size();
+				order.push_back(id);
+			}
+			return newIds[id];
+		};
+
+	for (const auto & [product, deps] : records) {
+		remap(product);
+		for (uint32_t dep : deps) {
+			remap(dep);
+		}
+	}
+
+	StateFileWriter writer(DEPS_LOG_MAGIC, DEPS_LOG_VERSION);
+
+	writer.Write(static_cast<uint32_t>(order.size()));
+	for (uint32_t id : order) {
+		writer.WriteString(paths[id]);
+	}
+
+	writer.Write(static_cast<uint32_t>(records.size()));
+	for (const auto & [product, deps] : records) {
+		writer.Write(newIds[product]);
+		writer.Write(static_cast<uint32_t>(deps.size()));
+		for (uint32_t dep : deps) {
+			writer.Write(newIds[dep]);
+		}
+	}
+
+	if (!writer.Commit(logPath))
+		warn("Could not write deps log '%s'", logPath.c_str());
+
+	dirty = false;
+}
+
+bool
+DepsLog::GetDeps(const Path & product, std::vector<Path> & deps) const
+{
+	auto idIt = pathIds.find(product.string());
+	if (idIt == pathIds.end())
+		return false;
+
+	auto it = records.find(idIt->second);
+	if (it == records.end())
+		return false;
+
+	for (uint32_t dep : it->second) {
+		deps.emplace_back(paths[dep]);
+	}
+
+	return true;
+}
+
+void
+DepsLog::Record(const Path & product, const std::vector<Path> & deps)
+{
+	DepList list;
+
+	for (const Path & dep : deps) {
+		list.push_back(InternPath(dep.string()));
+	}
+
+	records[InternPath(product.string())] = std::move(list);
+	dirty = true;
+}
+
+void
+DepsLog::Forget(const Path & product)
+{
+	auto idIt = pathIds.find(product.string());
+	if (idIt == pathIds.end())
+		return;
+
+	if (records.erase(idIt->second) != 0)
+		dirty = true;
+}
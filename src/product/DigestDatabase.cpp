@@ -0,0 +1,321 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DigestDatabase.h"
+
+#include "Digest.h"
+#include "ParallelFor.h"
+#include "StateFile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <time.h>
+
+#define DIGEST_DB_MAGIC		0x46444200 /* "FDB\0" */
+#define DIGEST_DB_VERSION	1
+
+DigestDatabase::DigestDatabase(Path path)
+  : dbPath(std::move(path)),
+    dirty(false)
+{
+	Load();
+}
+
+DigestDatabase::~DigestDatabase()
+{
+	/*
+	 * We're destroyed on exit() even if the build failed, so this
+	 * preserves the records for everything that did build successfully.
+	 */
+	Save();
+}
+
+bool
+DigestDatabase::GetFileKey(const Path & path, FileKey & key)
+{
+	struct stat sb;
+
+	if (stat(path.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode))
+		return false;
+
+	key.dev = sb.st_dev;
+	key.ino = sb.st_ino;
+	key.size = sb.st_size;
+	key.mtimeSec = sb.st_mtim.tv_sec;
+	key.mtimeNsec = sb.st_mtim.tv_nsec;
+	return true;
+}
+
+void
+DigestDatabase::Load()
+{
+	StateFileReader reader;
+
+	if (!reader.Open(dbPath, DIGEST_DB_MAGIC, DIGEST_DB_VERSION))
+		return;
+
+	FileMap loadedFiles;
+	uint32_t numFiles = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numFiles && !reader.Failed(); ++i) {
+		std::string path(reader.ReadString());
+		FileKey key;
+
+		key.dev = reader.Read<uint64_t>();
+		key.ino = reader.Read<uint64_t>();
+		key.size = reader.Read<int64_t>();
+		key.mtimeSec = reader.Read<int64_t>();
+		key.mtimeNsec = reader.Read<int64_t>();
+		uint64_t digest = reader.Read<uint64_t>();
+
+		loadedFiles.emplace(std::move(path), FileEntry{key, digest});
+	}
+
+	BuildMap loadedBuilds;
+	uint32_t numBuilds = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numBuilds && !reader.Failed(); ++i) {
+		InputDigestMap & inputs = loadedBuilds[std::string(reader.ReadString())];
+
+		uint32_t numInputs = reader.Read<uint32_t>();
+		for (uint32_t j = 0; j < numInputs && !reader.Failed(); ++j) {
+			std::string input(reader.ReadString());
+			inputs[std::move(input)] = reader.Read<uint64_t>();
+		}
+	}
+
+	if (reader.Failed() || !reader.AtEnd()) {
+		warnx("Ignoring corrupt digest database '%s'", dbPath.c_str());
+		return;
+	}
+
+	files = std::move(loadedFiles);
+	builds = std::move(loadedBuilds);
+}
+
+void
+DigestDatabase::Save()
+{
+	if (!dirty)
+		return;
+
+	StateFileWriter writer(DIGEST_DB_MAGIC, DIGEST_DB_VERSION);
+
+	writer.Write(static_cast<uint32_t>(files.size()));
+	for (const auto & [path, entry] : files) {
+		const FileKey & key = entry.key;
+
+		writer.WriteString(path);
+		writer.Write(key.dev);
+		writer.Write(key.ino);
+		writer.Write(key.size);
+		writer.Write(key.mtimeSec);
+		writer.Write(key.mtimeNsec);
+		writer.Write(entry.digest);
+	}
+
+	writer.Write(static_cast<uint32_t>(builds.size()));
+	for (const auto & [product, inputs] : builds) {
+		writer.WriteString(product);
+		writer.Write(static_cast<uint32_t>(inputs.size()));
+		for (const auto & [input, digest] : inputs) {
+			writer.WriteString(input);
+			writer.Write(digest);
+		}
+	}
+
+	if (!writer.Commit(dbPath))
+		warn("Could not write digest database '%s'", dbPath.c_str());
+
+	dirty = false;
+}
+
+bool
+DigestDatabase::LookupDigest(const std::string & path, const FileKey & key,
+    uint64_t & digest) const
+{
+	auto it = files.find(path);
+	if (it == files.end() || !(it->second.key == key))
+		return false;
+
+	digest = it->second.digest;
+	return true;
+}
+
+void
+DigestDatabase::Prefetch(const std::vector<Path> & paths)
+{
+	struct Result
+	{
+		FileKey key;
+		uint64_t digest;
+		bool hashed;
+	};
+
+	std::vector<Result> results(paths.size());
+
+	/*
+	 * The file map is only read, never modified, by the workers; all
+	 * updates are applied afterwards on this thread.
+	 */
+	ParallelFor(paths.size(), [this, &paths, &results](size_t i)
+		{
+			Result & result = results[i];
+
+			result.hashed = false;
+			if (!GetFileKey(paths[i], result.key))
+				return;
+
+			if (LookupDigest(paths[i].string(), result.key, result.digest))
+				return;
+
+			result.hashed = DigestFile(paths[i], result.digest);
+		});
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		const Result & result = results[i];
+
+		if (result.hashed) {
+			files[paths[i].string()] = FileEntry{result.key, result.digest};
+			dirty = true;
+		}
+	}
+}
+
+bool
+DigestDatabase::GetEntry(const Path & path, FileEntry & entry)
+{
+
+	if (!GetFileKey(path, entry.key))
+		return false;
+
+	if (LookupDigest(path.string(), entry.key, entry.digest))
+		return true;
+
+	if (!DigestFile(path, entry.digest))
+		return false;
+
+	files[path.string()] = entry;
+	dirty = true;
+	return true;
+}
+
+bool
+DigestDatabase::GetDigest(const Path & path, uint64_t & digest)
+{
+	FileEntry entry;
+
+	if (!GetEntry(path, entry))
+		return false;
+
+	digest = entry.digest;
+	return true;
+}
+
+bool
+DigestDatabase::InputChanged(const Path & product, const Path & input)
+{
+	auto buildIt = builds.find(product.string());
+	if (buildIt == builds.end())
+		return true;
+
+	auto inputIt = buildIt->second.find(input.string());
+	if (inputIt == buildIt->second.end())
+		return true;
+
+	uint64_t digest;
+	if (!GetDigest(input, digest))
+		return true;
+
+	return digest != inputIt->second;
+}
+
+void
+DigestDatabase::BuildStarted(const Path & product, const std::vector<Path> & inputs)
+{
+	RunningBuild & build = running[product.string()];
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	build.startSec = now.tv_sec;
+	build.inputs.clear();
+
+	for (const Path & input : inputs) {
+		FileEntry entry;
+
+		if (GetEntry(input, entry))
+			build.inputs.emplace(input.string(), entry);
+	}
+}
+
+void
+DigestDatabase::RecordBuild(const Path & product, const std::vector<Path> & inputs)
+{
+	InputDigestMap record;
+	auto runIt = running.find(product.string());
+
+	for (const Path & input : inputs) {
+		FileKey key;
+		uint64_t digest;
+
+		if (runIt != running.end()) {
+			const RunningBuild & build = runIt->second;
+
+			/*
+			 * An input that changed while the command ran is left
+			 * out, so the next build runs the command again.
+			 */
+			if (!GetFileKey(input, key))
+				continue;
+
+			auto it = build.inputs.find(input.string());
+			if (it != build.inputs.end()) {
+				if (it->second.key == key)
+					record.emplace(input.string(), it->second.digest);
+				continue;
+			}
+
+			/*
+			 * Inputs that only the command's depfile named weren't
+			 * known when it started; go by their modification time,
+			 * to the second, as some filesystems keep no finer.
+			 */
+			if (key.mtimeSec >= build.startSec)
+				continue;
+		}
+
+		if (GetDigest(input, digest))
+			record.emplace(input.string(), digest);
+	}
+
+	if (runIt != running.end())
+		running.erase(runIt);
+
+	builds[product.string()] = std::move(record);
+	dirty = true;
+}
@@ -0,0 +1,375 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "GraphCache.h"
+
+#include "HashUtil.h"
+#include "StateFile.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+
+#include <algorithm>
+#include <string_view>
+
+// Not defined by any header(!)
+extern char ** environ;
+
+#define GRAPH_CACHE_MAGIC	0x46474300 /* "FGC\0" */
+#define GRAPH_CACHE_VERSION	9
+
+GraphCache::GraphCache(Path path)
+  : cachePath(std::move(path)),
+    workdir(std::filesystem::current_path().string()),
+    envHash(HashEnvironment()),
+    replaying(false)
+{
+}
+
+uint64_t
+GraphCache::HashEnvironment()
+{
+	std::vector<std::string_view> env;
+
+	for (int i = 0; environ[i] != NULL; ++i) {
+		env.push_back(environ[i]);
+	}
+
+	/* The order of the environment is not significant. */
+	std::sort(env.begin(), env.end());
+
+	uint64_t hash = fnv1a_hash("");
+	for (std::string_view var : env) {
+		/* Include the terminator so "AB","C" differs from "A","BC". */
+		hash = fnv1a_hash(std::string_view(var.data(), var.size() + 1), hash);
+	}
+
+	return hash;
+}
+
+bool
+GraphCache::StatScript(const std::string & path, ScriptInput & input)
+{
+	struct stat sb;
+
+	if (stat(path.c_str(), &sb) != 0)
+		return false;
+
+	input.path = path;
+	input.mtimeSec = sb.st_mtim.tv_sec;
+	input.mtimeNsec = sb.st_mtim.tv_nsec;
+	input.size = sb.st_size;
+	return true;
+}
+
+void
+GraphCache::AddScript(const std::string & path)
+{
+	ScriptInput input;
+
+	/*
+	 * If we can't stat the script then it won't be runnable either, and
+	 * the interpreter will report the error.
+	 */
+	if (StatScript(path, input))
+		scripts.push_back(std::move(input));
+}
+
+void
+GraphCache::RecordCommand(const std::vector<std::string> & products,
+    const std::vector<std::string> & inputs,
+    const std::vector<std::string> & argList,
+    const CommandOptions & options,
+    const std::string & configuration)
+{
+	if (replaying)
+		return;
+
+	commands.push_back({products, inputs, argList, options, configuration});
+}
+
+void
+GraphCache::RecordInputRoot(const std::string & path,
+    const std::optional<Path> & stamp)
+{
+	if (replaying)
+		return;
+
+	inputRoots.push_back({path, stamp});
+}
+
+void
+GraphCache::RecordPool(const std::string & name, uint32_t depth)
+{
+	if (replaying)
+		return;
+
+	pools.push_back({name, depth});
+}
+
+void
+GraphCache::WriteOptional(StateFileWriter & writer, const std::optional<Path> & path)
+{
+	writer.Write<uint8_t>(path.has_value());
+	if (path)
+		writer.WriteString(path->string());
+}
+
+std::optional<Path>
+GraphCache::ReadOptional(StateFileReader & reader)
+{
+	if (reader.Read<uint8_t>() == 0)
+		return std::nullopt;
+
+	return Path(reader.ReadString());
+}
+
+void
+GraphCache::Save()
+{
+	StateFileWriter writer(GRAPH_CACHE_MAGIC, GRAPH_CACHE_VERSION);
+
+	writer.WriteString(workdir);
+	writer.Write(envHash);
+	writer.WriteStringList(configurations);
+
+	writer.Write(static_cast<uint32_t>(scripts.size()));
+	for (const ScriptInput & script : scripts) {
+		writer.WriteString(script.path);
+		writer.Write(script.mtimeSec);
+		writer.Write(script.mtimeNsec);
+		writer.Write(script.size);
+	}
+
+	writer.Write(static_cast<uint32_t>(inputRoots.size()));
+	for (const CachedInputRoot & root : inputRoots) {
+		writer.WriteString(root.path);
+		WriteOptional(writer, root.stamp);
+	}
+
+	writer.Write(static_cast<uint32_t>(pools.size()));
+	for (const CachedPool & pool : pools) {
+		writer.WriteString(pool.name);
+		writer.Write(pool.depth);
+	}
+
+	writer.Write(static_cast<uint32_t>(commands.size()));
+	for (const CachedCommand & command : commands) {
+		const CommandOptions & opt = command.options;
+
+		writer.WriteStringList(command.products);
+		writer.WriteStringList(command.inputs);
+		writer.WriteStringList(command.argList);
+		writer.WriteStringList(opt.tmpdirs);
+		WriteOptional(writer, opt.workdir);
+		WriteOptional(writer, opt.stdin);
+		WriteOptional(writer, opt.stdout);
+		writer.WriteStringList(opt.statdirs);
+		writer.WriteStringList(opt.orderDeps);
+		writer.WriteStringList(opt.targetList);
+		writer.Write<uint8_t>(opt.restat);
+		writer.Write<uint8_t>(opt.ephemeral);
+		writer.Write<uint8_t>(opt.stream);
+		writer.Write<uint8_t>(opt.jobserver);
+		WriteOptional(writer, opt.depfile);
+		writer.WriteString(opt.pool);
+		writer.Write(opt.cpus);
+		writer.Write(opt.memory);
+		writer.WriteString(command.configuration);
+	}
+
+	if (!writer.Commit(cachePath))
+		warn("Could not write build graph cache '%s'", cachePath.c_str());
+}
+
+bool
+GraphCache::ReadInputRoots(StateFileReader & reader)
+{
+	uint32_t count = reader.Read<uint32_t>();
+
+	for (uint32_t i = 0; i < count && !reader.Failed(); ++i) {
+		CachedInputRoot root;
+
+		root.path = reader.ReadString();
+		root.stamp = ReadOptional(reader);
+
+		inputRoots.push_back(std::move(root));
+	}
+
+	return !reader.Failed();
+}
+
+bool
+GraphCache::ReadPools(StateFileReader & reader)
+{
+	uint32_t count = reader.Read<uint32_t>();
+
+	for (uint32_t i = 0; i < count && !reader.Failed(); ++i) {
+		CachedPool pool;
+
+		pool.name = reader.ReadString();
+		pool.depth = reader.Read<uint32_t>();
+
+		pools.push_back(std::move(pool));
+	}
+
+	return !reader.Failed();
+}
+
+bool
+GraphCache::ReadCommands(StateFileReader & reader)
+{
+	uint32_t count = reader.Read<uint32_t>();
+
+	for (uint32_t i = 0; i < count && !reader.Failed(); ++i) {
+		CachedCommand command;
+		CommandOptions & opt = command.options;
+
+		command.products = reader.ReadStringList();
+		command.inputs = reader.ReadStringList();
+		command.argList = reader.ReadStringList();
+		opt.tmpdirs = reader.ReadStringList();
+		opt.workdir = ReadOptional(reader);
+		opt.stdin = ReadOptional(reader);
+		opt.stdout = ReadOptional(reader);
+		opt.statdirs = reader.ReadStringList();
+		opt.orderDeps = reader.ReadStringList();
+		opt.targetList = reader.ReadStringList();
+		opt.restat = reader.Read<uint8_t>() != 0;
+		opt.ephemeral = reader.Read<uint8_t>() != 0;
+		opt.stream = reader.Read<uint8_t>() != 0;
+		opt.jobserver = reader.Read<uint8_t>() != 0;
+		opt.depfile = ReadOptional(reader);
+		opt.pool = reader.ReadString();
+		opt.cpus = reader.Read<uint32_t>();
+		opt.memory = reader.Read<uint64_t>();
+		command.configuration = reader.ReadString();
+
+		commands.push_back(std::move(command));
+	}
+
+	return !reader.Failed() && reader.AtEnd();
+}
+
+bool
+GraphCache::Load(CommandFactory & factory)
+{
+	StateFileReader reader;
+
+	if (!reader.Open(cachePath, GRAPH_CACHE_MAGIC, GRAPH_CACHE_VERSION))
+		return false;
+
+	if (reader.ReadString() != workdir || reader.Read<uint64_t>() != envHash)
+		return false;
+
+	if (reader.ReadStringList() != configurations)
+		return false;
+
+	std::vector<ScriptInput> cachedScripts;
+	uint32_t numScripts = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numScripts && !reader.Failed(); ++i) {
+		ScriptInput cached, current;
+
+		cached.path = reader.ReadString();
+		cached.mtimeSec = reader.Read<int64_t>();
+		cached.mtimeNsec = reader.Read<int64_t>();
+		cached.size = reader.Read<int64_t>();
+
+		if (reader.Failed())
+			return false;
+
+		if (!StatScript(cached.path, current) || !(current == cached))
+			return false;
+
+		cachedScripts.push_back(std::move(cached));
+	}
+
+	/*
+	 * Parse every command before adding any of them, so that a truncated
+	 * or corrupt cache can't leave us with half of a graph.
+	 */
+	if (!ReadInputRoots(reader) || !ReadPools(reader) ||
+	    !ReadCommands(reader)) {
+		inputRoots.clear();
+		pools.clear();
+		commands.clear();
+		return false;
+	}
+
+	scripts = std::move(cachedScripts);
+
+	replaying = true;
+	for (const CachedInputRoot & root : inputRoots) {
+		factory.AddInputRoot(root.path, root.stamp);
+	}
+
+	for (const CachedPool & pool : pools) {
+		factory.AddPool(pool.name, pool.depth);
+	}
+
+	for (const CachedCommand & command : commands) {
+		CommandOptions opt(command.options);
+		std::vector<std::string> argList(command.argList);
+
+		factory.SetConfiguration(command.configuration);
+		factory.AddCommand(command.products, command.inputs,
+		    std::move(argList), std::move(opt));
+	}
+	factory.SetConfiguration("");
+	factory.CheckStreams();
+	replaying = false;
+
+	return true;
+}
+
+std::vector<Path>
+GraphCache::GetScripts() const
+{
+	std::vector<Path> paths;
+
+	for (const ScriptInput & script : scripts) {
+		paths.emplace_back(script.path);
+	}
+
+	return paths;
+}
+
+bool
+GraphCache::IsCurrent() const
+{
+	ScriptInput current;
+
+	for (const ScriptInput & script : scripts) {
+		if (!StatScript(script.path, current) || !(current == script))
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,157 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "JobHistory.h"
+
+#include "Command.h"
+#include "Digest.h"
+#include "StateFile.h"
+
+#include <err.h>
+
+#include <algorithm>
+#include <string>
+
+#define JOB_HISTORY_MAGIC	0x464a4800 /* "FJH\0" */
+#define JOB_HISTORY_VERSION	2
+
+/* Drop the entries that the last this many builds didn't look up. */
+#define JOB_HISTORY_MAX_AGE	32
+
+JobHistory::JobHistory(Path path)
+  : historyPath(std::move(path)),
+    build(0),
+    dirty(false)
+{
+	Load();
+	build++;
+}
+
+JobHistory::~JobHistory()
+{
+	Save();
+}
+
+void
+JobHistory::Load()
+{
+	StateFileReader reader;
+
+	if (!reader.Open(historyPath, JOB_HISTORY_MAGIC, JOB_HISTORY_VERSION))
+		return;
+
+	DurationMap loaded;
+	uint32_t lastBuild = reader.Read<uint32_t>();
+	uint32_t numEntries = reader.Read<uint32_t>();
+	for (uint32_t i = 0; i < numEntries && !reader.Failed(); ++i) {
+		uint64_t fingerprint = reader.Read<uint64_t>();
+		Entry & entry = loaded[fingerprint];
+		entry.msec = reader.Read<uint64_t>();
+		entry.lastUsed = reader.Read<uint32_t>();
+	}
+
+	if (reader.Failed() || !reader.AtEnd()) {
+		warnx("Ignoring corrupt job history '%s'", historyPath.c_str());
+		return;
+	}
+
+	build = lastBuild;
+	durations = std::move(loaded);
+}
+
+void
+JobHistory::Save()
+{
+	if (!dirty)
+		return;
+
+	for (auto it = durations.begin(); it != durations.end(); ) {
+		if (build - it->second.lastUsed >= JOB_HISTORY_MAX_AGE)
+			it = durations.erase(it);
+		else
+			++it;
+	}
+
+	StateFileWriter writer(JOB_HISTORY_MAGIC, JOB_HISTORY_VERSION);
+
+	writer.Write(build);
+	writer.Write(static_cast<uint32_t>(durations.size()));
+	for (const auto & [fingerprint, entry] : durations) {
+		writer.Write(fingerprint);
+		writer.Write(entry.msec);
+		writer.Write(entry.lastUsed);
+	}
+
+	if (!writer.Commit(historyPath))
+		warn("Could not write job history '%s'", historyPath.c_str());
+
+	dirty = false;
+}
+
+uint64_t
+JobHistory::Fingerprint(const Command & command)
+{
+	std::string key;
+
+	/* Fields are NUL-terminated so that they can't run together. */
+	for (const Command * c = &command; c; c = c->GetUpstream()) {
+		key.append(c->GetWorkDir().string()).push_back('\0');
+		for (const std::string & arg : c->GetArgList()) {
+			key.append(arg).push_back('\0');
+		}
+		if (c->GetStdin())
+			key.append(c->GetStdin()->string());
+		key.push_back('\0');
+		if (c->GetStdout())
+			key.append(c->GetStdout()->string());
+		key.push_back('\0');
+	}
+
+	return DigestBuffer(key.data(), key.size());
+}
+
+bool
+JobHistory::GetDuration(const Command & command, uint64_t & msec)
+{
+	auto it = durations.find(Fingerprint(command));
+	if (it == durations.end())
+		return false;
+
+	/* Only saved if the build runs something. */
+	it->second.lastUsed = build;
+	msec = it->second.msec;
+	return true;
+}
+
+void
+JobHistory::Record(const Command & command, uint64_t msec)
+{
+
+	durations[Fingerprint(command)] = Entry{msec, build};
+	dirty = true;
+}
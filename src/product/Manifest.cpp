@@ -0,0 +1,594 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Manifest.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <deque>
+#include <unordered_map>
+
+namespace
+{
+typedef std::vector<std::string_view> WordList;
+typedef std::unordered_map<std::string_view, WordList> VarMap;
+
+/* The variables that a word is expanded with, besides the top-level ones. */
+struct Scope
+{
+	const VarMap * vars;
+	const WordList * out;
+	const WordList * in;
+};
+
+class ManifestReader
+{
+	struct Rule
+	{
+		std::string_view name;
+		VarMap bindings;
+	};
+
+	enum Block { NONE, RULE, BUILD };
+
+	std::string_view contents;
+	const ManifestCallback & callback;
+	std::string & error;
+
+	size_t pos;
+	size_t line;
+	size_t stmtLine;
+
+	/*
+	 * Words are views of the manifest itself, except for those that had
+	 * to be rewritten to expand them, which are kept here.
+	 */
+	std::deque<std::string> expanded;
+
+	VarMap globals;
+	std::unordered_map<std::string_view, Rule> rules;
+
+	Block block;
+	Rule * rule;
+	const Rule * buildRule;
+	WordList buildProducts;
+	WordList buildInputs;
+	VarMap buildVars;
+
+	static bool IsBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static bool IsVarChar(char c)
+	{
+		return isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+		    c == '-';
+	}
+
+	static bool IsOption(std::string_view key);
+	static size_t VarReference(std::string_view word, size_t at,
+	    std::string_view & name);
+
+	bool Error(const std::string & msg);
+	bool AtContinuation() const;
+	void SkipBlanks();
+	bool ReadLine(WordList & words, bool & indented);
+
+	const WordList * Lookup(std::string_view name, const Scope & scope) const;
+	bool Expand(std::string_view word, const Scope & scope, WordList & list);
+	bool ExpandAll(const WordList & words, const Scope & scope, WordList & list);
+
+	bool ParseBinding(const WordList & words);
+	bool ParseRule(const WordList & words);
+	bool ParseBuild(const WordList & words);
+	bool FinishBlock();
+	bool EmitCommand();
+	bool SetOption(ManifestCommand & command, std::string_view key,
+	    const WordList & values);
+
+public:
+	ManifestReader(std::string_view c, const ManifestCallback & cb,
+	    std::string & e)
+	  : contents(c),
+	    callback(cb),
+	    error(e),
+	    pos(0),
+	    line(1),
+	    stmtLine(1),
+	    block(NONE),
+	    rule(nullptr),
+	    buildRule(nullptr)
+	{
+	}
+
+	bool Parse();
+};
+
+bool
+ParseNumber(std::string_view word, uint64_t & value)
+{
+	auto [end, ec] = std::from_chars(word.data(), word.data() + word.size(),
+	    value);
+
+	return ec == std::errc() && end == word.data() + word.size();
+}
+
+void
+AppendStrings(const WordList & words, std::vector<std::string> & list)
+{
+
+	for (std::string_view word : words)
+		list.emplace_back(word);
+}
+
+bool
+ManifestReader::IsOption(std::string_view key)
+{
+	static const std::string_view options[] = {
+		"tmpdirs", "workdir", "stdin", "stdout", "statdirs",
+		"order_deps", "targets", "restat", "ephemeral", "stream",
+		"jobserver", "depfile", "pool", "cpus", "memory"
+	};
+
+	for (std::string_view option : options) {
+		if (key == option)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Parse the variable reference at word[at], which is a '$'.  Returns the
+ * length of the reference, or 0 if there isn't a valid one.
+ */
+size_t
+ManifestReader::VarReference(std::string_view word, size_t at,
+    std::string_view & name)
+{
+	size_t end;
+
+	if (word.compare(at, 2, "${") == 0) {
+		end = word.find('}', at + 2);
+		if (end == std::string_view::npos || end == at + 2)
+			return 0;
+
+		name = word.substr(at + 2, end - at - 2);
+		return end + 1 - at;
+	}
+
+	end = at + 1;
+	while (end < word.size() && IsVarChar(word[end]))
+		end++;
+
+	name = word.substr(at + 1, end - at - 1);
+	return name.empty() ? 0 : end - at;
+}
+
+bool
+ManifestReader::Error(const std::string & msg)
+{
+
+	error = "line " + std::to_string(stmtLine) + ": " + msg;
+	return false;
+}
+
+bool
+ManifestReader::AtContinuation() const
+{
+
+	return contents.compare(pos, 2, "$\n") == 0 ||
+	    contents.compare(pos, 3, "$\r\n") == 0;
+}
+
+void
+ManifestReader::SkipBlanks()
+{
+
+	while (pos < contents.size()) {
+		if (IsBlank(contents[pos])) {
+			pos++;
+		} else if (AtContinuation()) {
+			pos = contents.find('\n', pos) + 1;
+			line++;
+		} else {
+			break;
+		}
+	}
+}
+
+/*
+ * Split the next line that isn't blank or a comment into words, which are
+ * left unexpanded.  Returns false at the end of the manifest, or if the
+ * line is malformed (in which case error is set).
+ */
+bool
+ManifestReader::ReadLine(WordList & words, bool & indented)
+{
+
+	words.clear();
+	indented = false;
+	while (words.empty() && pos < contents.size()) {
+		stmtLine = line;
+		indented = IsBlank(contents[pos]);
+		SkipBlanks();
+
+		if (pos < contents.size() && contents[pos] == '#')
+			pos = std::min(contents.find('\n', pos), contents.size());
+
+		while (pos < contents.size() && contents[pos] != '\n') {
+			size_t start = pos;
+
+			while (pos < contents.size() && !IsBlank(contents[pos]) &&
+			    contents[pos] != '\n' && !AtContinuation()) {
+				if (contents[pos] == '$') {
+					if (pos + 1 == contents.size())
+						return Error("manifest ends with '$'");
+					pos++;
+				}
+				pos++;
+			}
+
+			words.push_back(contents.substr(start, pos - start));
+			SkipBlanks();
+		}
+
+		if (pos < contents.size()) {
+			pos++;
+			line++;
+		}
+	}
+
+	return !words.empty();
+}
+
+const WordList *
+ManifestReader::Lookup(std::string_view name, const Scope & scope) const
+{
+
+	if (scope.vars) {
+		auto it = scope.vars->find(name);
+		if (it != scope.vars->end())
+			return &it->second;
+	}
+
+	if (scope.out && name == "out")
+		return scope.out;
+	if (scope.in && name == "in")
+		return scope.in;
+
+	auto it = globals.find(name);
+	if (it != globals.end())
+		return &it->second;
+
+	return nullptr;
+}
+
+bool
+ManifestReader::Expand(std::string_view word, const Scope & scope, WordList & list)
+{
+	std::string_view name;
+	const WordList * value;
+
+	if (word.find('$') == std::string_view::npos) {
+		list.push_back(word);
+		return true;
+	}
+
+	if (VarReference(word, 0, name) == word.size()) {
+		value = Lookup(name, scope);
+		if (!value)
+			return Error("undefined variable '" + std::string(name) + "'");
+
+		list.insert(list.end(), value->begin(), value->end());
+		return true;
+	}
+
+	std::string result;
+	size_t i = 0;
+	while (i < word.size()) {
+		if (word[i] != '$') {
+			result += word[i];
+			i++;
+			continue;
+		}
+
+		char next = word[i + 1];
+		if (next == '$' || IsBlank(next) || next == ':') {
+			result += next;
+			i += 2;
+			continue;
+		}
+
+		size_t len = VarReference(word, i, name);
+		if (len == 0)
+			return Error("bad '$' escape in '" + std::string(word) + "'");
+
+		value = Lookup(name, scope);
+		if (!value)
+			return Error("undefined variable '" + std::string(name) + "'");
+		if (value->size() > 1) {
+			return Error("variable '" + std::string(name) +
+			    "' has several words, so it must be a whole word");
+		}
+
+		if (!value->empty())
+			result += value->front();
+		i += len;
+	}
+
+	list.push_back(expanded.emplace_back(std::move(result)));
+	return true;
+}
+
+bool
+ManifestReader::ExpandAll(const WordList & words, const Scope & scope, WordList & list)
+{
+
+	for (std::string_view word : words) {
+		if (!Expand(word, scope, list))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Rule bindings are kept as written, to be expanded for each command.  The
+ * variables of a build statement are expanded right away, with the
+ * top-level variables, $in and $out.
+ */
+bool
+ManifestReader::ParseBinding(const WordList & words)
+{
+
+	if (words.size() < 2 || words[1] != "=")
+		return Error("expected '<name> = <value>'");
+
+	std::string_view key = words[0];
+	WordList value(words.begin() + 2, words.end());
+
+	switch (block) {
+	case NONE:
+		return Error("indented line outside of a rule or build statement");
+	case RULE:
+		if (key != "args" && key != "inputs" && !IsOption(key)) {
+			return Error("unknown key '" + std::string(key) + "' in rule '" +
+			    std::string(rule->name) + "'");
+		}
+
+		if (!rule->bindings.emplace(key, std::move(value)).second)
+			return Error("'" + std::string(key) + "' given twice");
+		return true;
+	case BUILD: {
+		WordList expandedValue;
+		Scope scope{nullptr, &buildProducts, &buildInputs};
+		if (!ExpandAll(value, scope, expandedValue))
+			return false;
+		buildVars[key] = std::move(expandedValue);
+		return true;
+	}
+	}
+
+	return false;
+}
+
+bool
+ManifestReader::ParseRule(const WordList & words)
+{
+
+	if (words.size() != 2)
+		return Error("expected 'rule <name>'");
+
+	auto [it, inserted] = rules.emplace(words[1], Rule());
+	if (!inserted)
+		return Error("rule '" + std::string(words[1]) + "' defined twice");
+
+	rule = &it->second;
+	rule->name = words[1];
+	block = RULE;
+	return true;
+}
+
+bool
+ManifestReader::ParseBuild(const WordList & words)
+{
+
+	auto colon = std::find(words.begin(), words.end(), ":");
+	if (colon == words.end() || colon == words.begin() + 1 ||
+	    colon + 1 == words.end())
+		return Error("expected 'build <products> : <rule> <inputs>'");
+
+	auto it = rules.find(colon[1]);
+	if (it == rules.end())
+		return Error("unknown rule '" + std::string(colon[1]) + "'");
+
+	buildRule = &it->second;
+	buildProducts.clear();
+	buildInputs.clear();
+	buildVars.clear();
+
+	if (!ExpandAll(WordList(words.begin() + 1, colon), Scope{}, buildProducts) ||
+	    !ExpandAll(WordList(colon + 2, words.end()), Scope{}, buildInputs))
+		return false;
+
+	block = BUILD;
+	return true;
+}
+
+bool
+ManifestReader::FinishBlock()
+{
+	Block finished = block;
+
+	block = NONE;
+	switch (finished) {
+	case NONE:
+		return true;
+	case RULE:
+		if (rule->bindings.count("args") == 0) {
+			return Error("rule '" + std::string(rule->name) +
+			    "' has no args");
+		}
+		return true;
+	case BUILD:
+		return EmitCommand();
+	}
+
+	return false;
+}
+
+bool
+ManifestReader::SetOption(ManifestCommand & command, std::string_view key,
+    const WordList & values)
+{
+	CommandOptions & options = command.options;
+
+	if (key == "args") {
+		AppendStrings(values, command.argList);
+	} else if (key == "inputs") {
+		AppendStrings(values, command.inputs);
+	} else if (key == "tmpdirs") {
+		AppendStrings(values, options.tmpdirs);
+	} else if (key == "statdirs") {
+		AppendStrings(values, options.statdirs);
+	} else if (key == "order_deps") {
+		AppendStrings(values, options.orderDeps);
+	} else if (key == "targets") {
+		AppendStrings(values, options.targetList);
+	} else if (values.size() != 1) {
+		return Error("'" + std::string(key) + "' must be a single word");
+	} else if (key == "workdir") {
+		options.workdir = Path(values.front());
+	} else if (key == "stdin") {
+		options.stdin = Path(values.front());
+	} else if (key == "stdout") {
+		options.stdout = Path(values.front());
+	} else if (key == "depfile") {
+		options.depfile = Path(values.front());
+	} else if (key == "pool") {
+		options.pool = values.front();
+	} else if (key == "cpus") {
+		uint64_t cpus;
+		if (!ParseNumber(values.front(), cpus) || cpus > UINT32_MAX)
+			return Error("'cpus' must be a number");
+		options.cpus = cpus;
+	} else if (key == "memory") {
+		if (!ParseNumber(values.front(), options.memory))
+			return Error("'memory' must be a number");
+	} else if (values.front() != "true" && values.front() != "false") {
+		return Error("'" + std::string(key) + "' must be true or false");
+	} else if (key == "restat") {
+		options.restat = (values.front() == "true");
+	} else if (key == "ephemeral") {
+		options.ephemeral = (values.front() == "true");
+	} else if (key == "jobserver") {
+		options.jobserver = (values.front() == "true");
+	} else {
+		options.stream = (values.front() == "true");
+	}
+
+	return true;
+}
+
+bool
+ManifestReader::EmitCommand()
+{
+	ManifestCommand command;
+	Scope scope{&buildVars, &buildProducts, &buildInputs};
+
+	AppendStrings(buildProducts, command.products);
+	AppendStrings(buildInputs, command.inputs);
+
+	for (const auto & [key, words] : buildRule->bindings) {
+		WordList values;
+
+		if (!ExpandAll(words, scope, values) ||
+		    !SetOption(command, key, values))
+			return false;
+	}
+
+	if (command.argList.empty())
+		return Error("command for '" + command.products.front() + "' has no args");
+
+	callback(std::move(command));
+	return true;
+}
+
+bool
+ManifestReader::Parse()
+{
+	WordList words;
+	bool indented;
+
+	while (ReadLine(words, indented)) {
+		if (indented) {
+			if (!ParseBinding(words))
+				return false;
+			continue;
+		}
+
+		if (!FinishBlock())
+			return false;
+
+		bool ok;
+		if (words[0] == "rule") {
+			ok = ParseRule(words);
+		} else if (words[0] == "build") {
+			ok = ParseBuild(words);
+		} else if (words.size() >= 2 && words[1] == "=") {
+			WordList value;
+			ok = ExpandAll(WordList(words.begin() + 2, words.end()),
+			    Scope{}, value);
+			globals[words[0]] = std::move(value);
+		} else {
+			ok = Error("unknown statement '" + std::string(words[0]) + "'");
+		}
+
+		if (!ok)
+			return false;
+	}
+
+	if (!error.empty())
+		return false;
+
+	return FinishBlock();
+}
+}
+
+bool
+ParseManifest(std::string_view contents, const ManifestCallback & callback,
+    std::string & error)
+{
+	ManifestReader reader(contents, callback, error);
+
+	error.clear();
+	return reader.Parse();
+}
@@ -0,0 +1,166 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Manifest.h"
+
+#include <gtest/gtest.h>
+
+class ManifestTestSuite : public ::testing::Test
+{
+};
+
+typedef std::vector<std::string> StringList;
+
+static bool
+Parse(std::string_view contents, std::vector<ManifestCommand> & commands,
+    std::string & error)
+{
+
+	return ParseManifest(contents, [&commands](ManifestCommand && c)
+	{
+		commands.push_back(std::move(c));
+	}, error);
+}
+
+TEST_F(ManifestTestSuite, TestSimple)
+{
+	std::vector<ManifestCommand> commands;
+	std::string error;
+
+	ASSERT_TRUE(Parse(
+	    "rule cc\n"
+	    "\targs = cc -c -o $out $in\n"
+	    "\n"
+	    "build foo.o : cc foo.c foo.h\n"
+	    "build bar.o : cc bar.c\n", commands, error)) << error;
+
+	ASSERT_EQ(commands.size(), 2);
+	EXPECT_EQ(commands[0].products, StringList({"foo.o"}));
+	EXPECT_EQ(commands[0].inputs, StringList({"foo.c", "foo.h"}));
+	EXPECT_EQ(commands[0].argList,
+	    StringList({"cc", "-c", "-o", "foo.o", "foo.c", "foo.h"}));
+	EXPECT_EQ(commands[1].argList,
+	    StringList({"cc", "-c", "-o", "bar.o", "bar.c"}));
+}
+
+TEST_F(ManifestTestSuite, TestVariables)
+{
+	std::vector<ManifestCommand> commands;
+	std::string error;
+
+	ASSERT_TRUE(Parse(
+	    "cflags = -O2 -pipe\n"
+	    "incdir = include\n"
+	    "rule cc\n"
+	    "\targs = cc $cflags -I$incdir -c $in\n"
+	    "build foo.o : cc foo.c\n"
+	    "build bar.o : cc bar.c\n"
+	    "\tcflags = -O0\n"
+	    "\tincdir = ${incdir}/bar\n", commands, error)) << error;
+
+	ASSERT_EQ(commands.size(), 2);
+	EXPECT_EQ(commands[0].argList,
+	    StringList({"cc", "-O2", "-pipe", "-Iinclude", "-c", "foo.c"}));
+	EXPECT_EQ(commands[1].argList,
+	    StringList({"cc", "-O0", "-Iinclude/bar", "-c", "bar.c"}));
+}
+
+TEST_F(ManifestTestSuite, TestOptions)
+{
+	std::vector<ManifestCommand> commands;
+	std::string error;
+
+	ASSERT_TRUE(Parse(
+	    "rule cc\n"
+	    "\targs = cc -MD -MF $out.d -o $out $in\n"
+	    "\tinputs = /usr/include /usr/bin\n"
+	    "\tdepfile = $out.d\n"
+	    "\trestat = true\n"
+	    "\tjobserver = true\n"
+	    "\ttargets = all objs\n"
+	    "\tpool = cc\n"
+	    "\tcpus = 2\n"
+	    "\tmemory = $mem\n"
+	    "build foo.o : cc foo.c\n"
+	    "\tmem = 4096\n", commands, error)) << error;
+
+	ASSERT_EQ(commands.size(), 1);
+	const ManifestCommand & c = commands[0];
+	EXPECT_EQ(c.inputs, StringList({"foo.c", "/usr/include", "/usr/bin"}));
+	EXPECT_EQ(c.argList[3], "foo.o.d");
+	ASSERT_TRUE(c.options.depfile.has_value());
+	EXPECT_EQ(c.options.depfile->string(), "foo.o.d");
+	EXPECT_TRUE(c.options.restat);
+	EXPECT_TRUE(c.options.jobserver);
+	EXPECT_EQ(c.options.targetList, StringList({"all", "objs"}));
+	EXPECT_EQ(c.options.pool, "cc");
+	EXPECT_EQ(c.options.cpus, 2);
+	EXPECT_EQ(c.options.memory, 4096);
+}
+
+TEST_F(ManifestTestSuite, TestEscapes)
+{
+	std::vector<ManifestCommand> commands;
+	std::string error;
+
+	ASSERT_TRUE(Parse(
+	    "# a comment\n"
+	    "rule echo\n"
+	    "\targs = echo cost$$ a$ b c$:d $\n"
+	    "\t    continued\n"
+	    "build my$ file : echo\n", commands, error)) << error;
+
+	ASSERT_EQ(commands.size(), 1);
+	EXPECT_EQ(commands[0].products, StringList({"my file"}));
+	EXPECT_EQ(commands[0].argList,
+	    StringList({"echo", "cost$", "a b", "c:d", "continued"}));
+}
+
+TEST_F(ManifestTestSuite, TestErrors)
+{
+	std::vector<ManifestCommand> commands;
+	std::string error;
+
+	EXPECT_FALSE(Parse("build foo.o : cc foo.c\n", commands, error));
+	EXPECT_EQ(error, "line 1: unknown rule 'cc'");
+
+	EXPECT_FALSE(Parse("rule cc\n\tcommand = cc\n", commands, error));
+	EXPECT_FALSE(Parse("rule cc\n\tinputs = /usr/include\n", commands, error));
+	EXPECT_FALSE(Parse("rule cc\n\targs = cc $cflags\nbuild a : cc\n",
+	    commands, error));
+	EXPECT_EQ(error, "line 3: undefined variable 'cflags'");
+
+	/* A list can only be used as a whole word. */
+	EXPECT_FALSE(Parse("rule cc\n\targs = cc -o$out\nbuild a b : cc\n",
+	    commands, error));
+	EXPECT_FALSE(Parse("\tfoo = bar\n", commands, error));
+	EXPECT_FALSE(Parse("rule ld\n\targs = ld\n\tmemory = 4G\nbuild a : ld\n",
+	    commands, error));
+	EXPECT_EQ(error, "line 4: 'memory' must be a number");
+	EXPECT_TRUE(commands.empty());
+}
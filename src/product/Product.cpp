@@ -34,17 +34,27 @@
 #include <sys/wait.h>
 #include <err.h>
 
-Product::Product(const Path & p, ProductManager & mgr)
-  : path(p),
+Product::Product(PathId id, ProductManager & mgr, bool aggregate)
+  : pathId(id),
+    graphIndex(DepGraph::NO_NODE),
     command(nullptr),
     productManager(mgr),
     needsBuild(false),
+    stale(false),
+    complete(false),
     isDirectory(false),
+    isAggregate(aggregate),
     statusValid(false)
 {
 
 }
 
+Path
+Product::GetPath() const
+{
+	return productManager.GetPathTree().GetPath(pathId);
+}
+
 bool
 Product::SetCommand(Command * c)
 {
@@ -55,24 +65,46 @@ Product::SetCommand(Command * c)
 	return true;
 }
 
-void
-Product::AddDependency(Product *d)
+DepGraph::Range
+Product::GetInputs() const
 {
+	return productManager.GetGraph().Inputs(graphIndex);
+}
 
-	dependencies.insert(d);
-	d->dependees.push_back(this);
+DepGraph::Range
+Product::GetDependees() const
+{
+	return productManager.GetGraph().Dependees(graphIndex);
 }
 
 void
-Product::DependencyComplete(Product * d)
+Product::DependencyComplete(Product * d, bool changed)
 {
-	if (!command) {
-		errx(1, "Internal error: product '%s' has no defined command", path.c_str());
+	if (changed)
+		stale = true;
+
+	if (!productManager.GetGraph().InputComplete(graphIndex))
+		return;
+
+	if (!command && !isAggregate) {
+		errx(1, "Internal error: product '%s' has no defined command", GetPath().c_str());
 	}
 
-	dependencies.erase(d);
-	if (dependencies.empty())
-		productManager.ProductReady(this);
+	productManager.ProductReady(this);
+}
+
+void
+Product::Complete(bool changed)
+{
+	/* Every product of a command is completed when the command is. */
+	if (complete)
+		return;
+
+	complete = true;
+	for (Product * d : GetDependees())
+		d->DependencyComplete(this, changed);
+
+	productManager.InputsConsumed(this);
 }
 
 void
@@ -81,22 +113,23 @@ Product::BuildComplete(int status, uintmax_t jobId)
 	if (WIFEXITED(status)) {
 		int code = WEXITSTATUS(status);
 		if (code == 0) {
-			fprintf(stderr, "Job %jd: '%s' is built\n", jobId, path.c_str());
-			for (Product * d : dependees)
-				d->DependencyComplete(this);
+			fprintf(stderr, "Job %jd: '%s' is built\n", jobId, GetPath().c_str());
+			bool changed = productManager.ProductChanged(this);
+			productManager.ProductBuilt(this);
+			Complete(changed);
 
 		} else {
 			fprintf(stderr, "Job %jd: %s: job exited with code %d\n",
-			     jobId, path.c_str(), code);
+			     jobId, GetPath().c_str(), code);
 			exit(1);
 		}
 	} else if(WIFSIGNALED(status)) {
 		fprintf(stderr, "Job %jd: %s: job terminated on signal %d\n",
-		     jobId, path.c_str(), WTERMSIG(status));
+		     jobId, GetPath().c_str(), WTERMSIG(status));
 		exit(1);
 	} else {
 		fprintf(stderr, "Job %jd: %s: job terminated on unknown code %d\n",
-		     jobId, path.c_str(), status);
+		     jobId, GetPath().c_str(), status);
 		exit(1);
 	}
 }
@@ -108,54 +141,77 @@ Product::SetNeedsBuild()
 		return;
 
 	needsBuild = true;
-	for (Product * p : dependees) {
-// 		fprintf(stderr, "'%s' needs build because '%s' needs build\n", p->path.c_str(), path.c_str());
-		p->SetNeedsBuild();
-	}
+	PropagateNeedsBuild();
 }
 
-bool
-Product::IsReady()
+void
+Product::MarkStale()
 {
+	stale = true;
+	SetNeedsBuild();
+}
 
-	auto it = dependencies.begin();
-	while (it != dependencies.end()) {
-		Product * input = *it;
-		if (!input->NeedsBuild()) {
-			it = dependencies.erase(it);
-		} else {
-			++it;
-// 			fprintf(stderr, "%s is not ready: %s needs build\n", path.c_str(), input->path.c_str());
+void
+Product::PropagateNeedsBuild()
+{
+	/* Iterative, as dependency chains can be deeper than the stack. */
+	std::vector<Product*> stack;
+
+	stack.push_back(this);
+	while (!stack.empty()) {
+		Product * p = stack.back();
+		stack.pop_back();
+
+		for (Product * d : p->GetDependees()) {
+			if (!d->needsBuild) {
+// 				fprintf(stderr, "'%s' needs build because '%s' needs build\n", d->GetPath().c_str(), p->GetPath().c_str());
+				d->needsBuild = true;
+				stack.push_back(d);
+			}
 		}
 	}
+}
+
+bool
+Product::IsReady() const
+{
+
+	return productManager.GetGraph().GetPending(graphIndex) == 0;
+}
+
+bool
+Product::IsScheduled() const
+{
 
-	return dependencies.empty();
+	return productManager.GetGraph().GetPending(graphIndex) != DepGraph::UNSCHEDULED;
 }
 
 void
-Product::CacheStatus() const
+Product::ProbeStatus() const
 {
-	status = std::filesystem::status(path);
-	modTime = std::filesystem::last_write_time(path);
+	status = FileStat::Probe(GetPath());
 	statusValid = true;
 }
 
-const std::filesystem::file_status &
+const FileStat &
 Product::GetStatus() const
 {
 	if (!statusValid) {
-		CacheStatus();
+		ProbeStatus();
 	}
 
 	return status;
 }
 
-std::filesystem::file_time_type
-Product::GetModifyTime() const
+void
+Product::SetStatus(const FileStat & st)
 {
-	if (!statusValid) {
-		CacheStatus();
-	}
+	status = st;
+	statusValid = true;
+}
 
-	return modTime;
+int64_t
+Product::GetModifyTime() const
+{
+	return GetStatus().mtime;
 }
@@ -28,321 +28,1356 @@
 
 #include "ProductManager.h"
 
+#include "Depfile.h"
+#include "DepsLog.h"
+#include "Digest.h"
+#include "DigestDatabase.h"
+#include "JobHistory.h"
 #include "JobQueue.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
 #include "Product.h"
+#include "StatCache.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
+/*
+ * stat() is mostly spent waiting on the filesystem (especially NFS), so use
+ * more threads than we have CPUs.
+ */
+#define PROBE_THREADS_PER_CPU	4
+
 ProductManager::ProductManager(JobQueue & jq)
-  : jobQueue(jq)
+  : jobQueue(jq),
+    digests(nullptr),
+    accessLog(nullptr),
+    depsLog(nullptr),
+    history(nullptr),
+    statCache(nullptr)
+{
+}
+
+Product *
+ProductManager::MakeProduct(PathId id)
+{
+	if (products.size() <= id)
+		products.resize(pathTree.Size());
+
+	products[id] = std::make_unique<Product>(id, *this);
+
+	return products[id].get();
+}
+
+/*
+ * Stat every product in the set that hasn't been already.  The filesystem is
+ * only ever probed for products that the requested targets need.
+ */
+void
+ProductManager::ProbeProducts(const std::unordered_set<Product*> & set)
+{
+	std::vector<Product*> found, probe;
+	FileStat cached;
+
+	for (Product *product : set) {
+		if (product->StatusValid())
+			continue;
+
+		found.push_back(product);
+
+		/* Only sources are cached; our commands change the rest. */
+		if (statCache && !product->IsBuildable() &&
+		    statCache->Lookup(product->GetPath(), cached)) {
+			product->SetStatus(cached);
+			continue;
+		}
+
+		probe.push_back(product);
+	}
+
+	ParallelFor(probe.size(), [&probe](size_t i)
+		{
+			probe[i]->ProbeStatus();
+		}, PROBE_THREADS_PER_CPU);
+
+	for (Product *product : found) {
+		const FileStat & status = product->GetStatus();
+
+		if (!status.exists) {
+			/* See FindHollowProducts(). */
+			if (!IsDiscoveredSource(product) && !IsEphemeral(product))
+				product->SetNeedsBuild();
+		} else if (status.isDirectory) {
+			product->SetDirectory();
+		}
+	}
+
+	if (statCache) {
+		for (Product *product : probe) {
+			if (!product->IsBuildable() && product->GetStatus().exists)
+				statCache->RecordMiss(product->GetPath());
+		}
+	}
+}
+
+Product *
+ProductManager::GetProduct(const Path & path, bool makeParent)
+{
+
+	return GetProduct(pathTree.Intern(path.c_str()), makeParent);
+}
+
+Product *
+ProductManager::GetProduct(PathId id, bool makeParent)
+{
+	bool madeProduct = false;
+
+	Product * product = FindProduct(id);
+	if (product == nullptr) {
+		product = MakeProduct(id);
+		madeProduct = true;
+	}
+
+	if (makeParent) {
+		Product * parent = GetProduct(pathTree.GetParent(id), false);
+		parent->SetDirectory();
+
+		if (madeProduct) {
+			dirOutputs.push_back(product);
+		}
+	}
+
+	return product;
+}
+
+Product *
+ProductManager::FindProduct(const Path &path)
+{
+	PathId id = pathTree.Find(path.c_str());
+	if (id == PathTree::INVALID) {
+		return nullptr;
+	}
+
+	return FindProduct(id);
+}
+
+Product *
+ProductManager::FindProduct(PathId id)
+{
+	if (id >= products.size()) {
+		return nullptr;
+	}
+
+	return products[id].get();
+}
+
+void
+ProductManager::AddDependency(Product * product, Product * input)
+{
+	if (product == input)
+		return;
+
+	graph.AddEdge(product, input);
+// 	fprintf(stderr, "%s depends on %s\n", product->GetPath().c_str(), input->GetPath().c_str());
+}
+
+bool
+ProductManager::InputChanged(const Path & product, const Product * input)
+{
+
+	if (!input->IsAggregate())
+		return digests->InputChanged(product, input->GetPath());
+
+	/* Build records list the files behind an aggregate, not the aggregate. */
+	for (const Product * file : input->GetInputs()) {
+		if (file->IsDirectory())
+			continue;
+
+		if (InputChanged(product, file))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Returns true if input is out of date relative to product as things stand
+ * on disk now.  Inputs that are going to be rebuilt are handled by the
+ * caller.  record is the product's path if the digest database has a build
+ * record for it.
+ */
+bool
+ProductManager::InputIsNewer(Product * product, const Product * input,
+    const Path * record)
+{
+	const FileStat & productStatus = product->GetStatus();
+
+	if (productStatus.isDirectory) {
+		/* A directory can not be rebuilt, so if it already exists, we are done. */
+		return false;
+	}
+
+	/* The product was up to date with it when it was deleted. */
+	if (hollowProducts.count(input) != 0)
+		return false;
+
+	const FileStat & inputStatus = input->GetStatus();
+	if (!inputStatus.exists) {
+// 		fprintf(stderr, "'%s' needs build because '%s' doesn't exist\n", product->GetPath().c_str(), input->GetPath().c_str());
+		return true;
+	}
+
+	if (inputStatus.isDirectory) {
+		/*
+		 * Directories are updated when any file in them is
+		 * written to; do not rebuild if object is older than
+		 * a directory it depends on as that's likely a false
+		 * dependency.
+		 */
+		return false;
+	}
+
+	if (input->IsAggregate() && rootFingerprints.count(input) == 0) {
+		const PathIdSet * accessed = FindAccesses(product);
+		if (accessed)
+			return AccessedInputIsNewer(product, input, *accessed, record);
+	}
+
+	/*
+	 * Input roots have no recorded contents, only a fingerprint, so they
+	 * are always compared by modification time.
+	 */
+	if (record && rootFingerprints.count(input) == 0) {
+		/*
+		 * Only a change to the input's contents since the
+		 * product was last built makes the product stale;
+		 * modification times are irrelevant.
+		 */
+		return InputChanged(*record, input);
+	}
+
+	if (productStatus.mtime < inputStatus.mtime) {
+// 		fprintf(stderr, "'%s' needs build because it is older than '%s'\n", product->GetPath().c_str(), input->GetPath().c_str());
+		return true;
+	}
+
+	return false;
+}
+
+bool
+ProductManager::FileExists(const Path & path) const
+{
+	/*
+	 * XXX The parent path of "foo" is "", which doesn't test as existing.
+	 * Pretend that is does and hope for the best.
+	 */
+	if (path.empty()) {
+		return true;
+	}
+
+	bool exists;
+	if (dirSnapshot.Lookup(path, exists)) {
+		return exists;
+	}
+
+	std::error_code error;
+
+	return fs::exists(path, error) && !error;
+}
+
+/*
+ * What the sandbox saw the command read is the most precise, but the files
+ * listed in its depfile will do.
+ */
+const ProductManager::PathIdSet *
+ProductManager::FindAccesses(Product * product)
+{
+	Command *c = product->GetCommand();
+
+	if (!c)
+		return nullptr;
+
+	if (accessLog) {
+		auto [logged, inserted] = loggedAccesses.emplace(c, nullptr);
+		if (inserted) {
+			const AccessLog::AccessSet * accessed =
+			    accessLog->Lookup(c->GetProducts().front()->GetPath());
+			if (accessed) {
+				logged->second = std::make_unique<PathIdSet>();
+				for (const std::string & path : *accessed) {
+					/* A file outside of the graph can't match. */
+					PathId id = pathTree.Find(path);
+					if (id != PathTree::INVALID)
+						logged->second->insert(id);
+				}
+			}
+		}
+
+		if (logged->second)
+			return logged->second.get();
+	}
+
+	auto it = depfileAccesses.find(c);
+	if (it == depfileAccesses.end())
+		return nullptr;
+
+	return &it->second;
+}
+
+/*
+ * Only the files in the directory that the command read the last time that
+ * it ran can make it stale.  Anything else that changes in the directory
+ * wasn't used.
+ */
+bool
+ProductManager::AccessedInputIsNewer(Product * product, const Product * aggregate,
+    const PathIdSet & accessed, const Path * record)
+{
+	for (const Product * file : aggregate->GetInputs()) {
+		if (file->IsDirectory())
+			continue;
+
+		if (!file->IsAggregate() &&
+		    accessed.count(file->GetPathId()) == 0)
+			continue;
+
+		if (InputIsNewer(product, file, record))
+			return true;
+	}
+
+	return false;
+}
+
+void
+ProductManager::SetInputs(Product * product, std::vector<Product*> inputs)
+{
+	for (Product *input : inputs) {
+		AddDependency(product, input);
+	}
+}
+
+/*
+ * A product that needs a build only because an input does isn't stale yet;
+ * if none of those inputs turn out to change, it can be skipped.  Inputs
+ * that are already out of date make it stale.
+ */
+void
+ProductManager::CheckNeedsBuild(Product * product)
+{
+	if (product->IsStale())
+		return;
+
+	if (!product->GetStatus().exists) {
+		/* Let whatever listed it as a dependency find out it's gone. */
+		if (IsDiscoveredSource(product))
+			return;
+
+// 		fprintf(stderr, "'%s' needs build because it doesn't exist\n", product->GetPath().c_str());
+		product->MarkStale();
+		return;
+	}
+
+	/* Build the product's path once, not for every input. */
+	Path path;
+	const Path * record = nullptr;
+	if (digests && !product->IsAggregate()) {
+		path = product->GetPath();
+		if (digests->HasBuildRecord(path))
+			record = &path;
+	}
+
+	for (const Product * input : product->GetInputs()) {
+		if (input->NeedsBuild()) {
+// 			fprintf(stderr, "'%s' needs build because '%s' needs build\n", product->GetPath().c_str(), input->GetPath().c_str());
+			product->SetNeedsBuild();
+			continue;
+		}
+
+		if (InputIsNewer(product, input, record)) {
+			product->MarkStale();
+			return;
+		}
+	}
+}
+
+/*
+ * Products that we build in a directory might not exist yet, so they won't
+ * be found by reading the directory; add them to the contents of every
+ * enclosing directory that has a new aggregate.
+ */
+void
+ProductManager::AddDirOutputs(const std::unordered_set<Product*> & dirs)
+{
+	for (Product *product : dirOutputs) {
+		if (product->IsDirectory())
+			continue;
+
+		PathId id = product->GetPathId();
+		while (id != PathTree::ROOT) {
+			id = pathTree.GetParent(id);
+
+			Product * dir = FindProduct(id);
+			if (!dir || dirs.count(dir) == 0)
+				continue;
+
+			AddDependency(aggregates[dir].get(), product);
+		}
+	}
+}
+
+/*
+ * Give every directory that a product in the set takes as an input an
+ * aggregate of the directory's contents.  Returns the new aggregates.
+ */
+std::vector<Product*>
+ProductManager::CalcDeps(const std::unordered_set<Product*> & set)
+{
+	std::unordered_set<Product*> inputDirs;
+	std::vector<Path> roots;
+
+	graph.ForEachEdge([this, &set, &inputDirs](Product * product, Product * input)
+		{
+			if (input->IsDirectory() && set.count(product) != 0 &&
+			    aggregates.count(input) == 0)
+				inputDirs.insert(input);
+		});
+
+	for (Product *dir : inputDirs) {
+		if (!FindInputRoot(dir->GetPath()))
+			roots.push_back(dir->GetPath());
+	}
+
+	/* Read every directory that we need the contents of in one pass. */
+	dirSnapshot.Walk(roots);
+
+	std::vector<Product*> newAggregates;
+	for (Product *dir : inputDirs) {
+		/*
+		 * Every dependee of the directory depends on the same set of
+		 * files, so route the edges through a single aggregate node
+		 * rather than adding an edge from each dependee to each file.
+		 */
+		Product * aggregate = MakeAggregate(dir);
+		newAggregates.push_back(aggregate);
+
+		const Path * fingerprint = FindInputRoot(dir->GetPath());
+		if (fingerprint) {
+			/*
+			 * Files under an input root are covered by its
+			 * fingerprint, so the directory isn't read.  Products
+			 * that we build there still need to be ordered.
+			 */
+			rootFingerprints.emplace(aggregate, *fingerprint);
+		} else {
+			std::vector<Path> files;
+
+			dirSnapshot.GetFiles(dir->GetPath(), files);
+			for (const Path & file : files) {
+				AddDependency(aggregate, GetProduct(file, false));
+			}
+		}
+	}
+
+	AddDirOutputs(inputDirs);
+
+	return newAggregates;
+}
+
+void
+ProductManager::FreezeGraph()
+{
+	std::vector<Product*> nodes;
+
+	/* Dependees of a directory really depend on its aggregate. */
+	graph.RewriteInputs([this](Product * input) -> Product *
+		{
+			auto it = aggregates.find(input);
+			if (it != aggregates.end())
+				return it->second.get();
+
+			/* Not an input of anything that we'll build. */
+			if (input->IsDirectory())
+				return nullptr;
+			return input;
+		});
+
+	/* Added last, as these are real dependencies on the directories. */
+	AddParentInputs();
+
+	for (auto & product : products) {
+		if (product) {
+			product->SetGraphIndex(nodes.size());
+			nodes.push_back(product.get());
+		}
+	}
+
+	for (auto & [dir, aggregate] : aggregates) {
+		aggregate->SetGraphIndex(nodes.size());
+		nodes.push_back(aggregate.get());
+	}
+
+	graph.Freeze(nodes);
+
+	/* Products found missing before there were any edges. */
+	for (Product * product : nodes) {
+		if (product->NeedsBuild())
+			product->PropagateNeedsBuild();
+	}
+}
+
+Product *
+ProductManager::MakeAggregate(Product *dir)
+{
+	auto aggregate = std::make_unique<Product>(dir->GetPathId(), *this, true);
+	Product * ptr = aggregate.get();
+	aggregates.insert(std::make_pair(dir, std::move(aggregate)));
+
+	return ptr;
+}
+
+void
+ProductManager::AddInputRoot(const Path & root, const Path & fingerprint)
+{
+	inputRoots[root] = fingerprint;
+}
+
+const Path *
+ProductManager::FindInputRoot(const Path & path) const
+{
+	if (inputRoots.empty())
+		return nullptr;
+
+	Path dir(path);
+	while (!dir.empty()) {
+		auto it = inputRoots.find(dir);
+		if (it != inputRoots.end())
+			return &it->second;
+
+		Path parent(dir.parent_path());
+		if (parent == dir)
+			break;
+		dir = std::move(parent);
+	}
+
+	return nullptr;
+}
+
+/*
+ * An aggregate is as new as the newest file in its directory, or the
+ * fingerprint of its input root.  This must be called after the directory
+ * contents have been probed.
+ */
+void
+ProductManager::UpdateAggregateStatus()
+{
+	for (auto & [dir, aggregate] : aggregates) {
+		FileStat status;
+
+		status.exists = true;
+
+		auto it = rootFingerprints.find(aggregate.get());
+		if (it != rootFingerprints.end()) {
+			FileStat fingerprint(FileStat::Probe(it->second));
+
+			/* Without a fingerprint, assume that the root changed. */
+			if (!fingerprint.exists) {
+				aggregate->SetStatus(fingerprint);
+				continue;
+			}
+
+			status.mtime = fingerprint.mtime;
+		}
+
+		for (Product *input : aggregate->GetInputs()) {
+			const FileStat & inputStatus = input->GetStatus();
+			if (inputStatus.exists && inputStatus.mtime > status.mtime)
+				status.mtime = inputStatus.mtime;
+		}
+
+		aggregate->SetStatus(status);
+	}
+}
+
+void
+ProductManager::CollectFileInputs(Product *product, std::vector<Product*> & files)
+{
+	for (Product *input : product->GetInputs()) {
+		if (input->IsAggregate()) {
+			CollectFileInputs(input, files);
+		} else if (!input->IsDirectory()) {
+			files.push_back(input);
+		}
+	}
+}
+
+void
+ProductManager::AddParentInputs()
+{
+	for (auto & product : products) {
+		if (!product)
+			continue;
+
+		Product * parent = FindProduct(pathTree.GetParent(product->GetPathId()));
+		if (parent)
+			AddDependency(product.get(), parent);
+	}
+}
+
+/*
+ * Add the dependencies that depfiles reported the last time that each
+ * command ran.  A command that writes a depfile but has no record of one
+ * must be rebuilt, as we don't know what it depends on.
+ */
+void
+ProductManager::AddLoggedDeps()
+{
+	std::vector<Path> deps;
+
+	if (!depsLog)
+		return;
+
+	/* Adding dependencies can create products; don't visit those. */
+	size_t numProducts = products.size();
+	for (size_t i = 0; i < numProducts; ++i) {
+		Product *product = products[i].get();
+		if (!product)
+			continue;
+
+		Command *c = product->GetCommand();
+		if (!c || !c->GetDepfile() || product != c->GetProducts().front())
+			continue;
+
+		deps.clear();
+		if (!depsLog->GetDeps(product->GetPath(), deps)) {
+			for (Product *p : c->GetProducts())
+				p->MarkStale();
+			continue;
+		}
+
+		PathIdSet & accessed = depfileAccesses[c];
+		for (const Path & path : deps) {
+			PathId id = pathTree.Intern(path.c_str());
+			accessed.insert(id);
+
+			Product *dep = FindProduct(id);
+			if (!dep) {
+				dep = MakeProduct(id);
+				discoveredDeps.insert(dep);
+			}
+
+			for (Product *p : c->GetProducts())
+				AddDependency(p, dep);
+		}
+	}
+}
+
+/*
+ * A depfile can list a header that has since been deleted, which is fine
+ * as long as nothing else needs it.
+ */
+bool
+ProductManager::IsDiscoveredSource(const Product *product) const
+{
+
+	return !product->IsBuildable() && discoveredDeps.count(product) != 0;
+}
+
+void
+ProductManager::IngestDepfile(Command *c)
+{
+	const Path & depfile = *c->GetDepfile();
+	Path product = c->GetProducts().front()->GetPath();
+	std::vector<std::string> deps;
+	MappedFile file;
+
+	if (!file.Open(depfile)) {
+		warn("Could not read depfile '%s'", depfile.c_str());
+		depsLog->Forget(product);
+		return;
+	}
+
+	if (!ParseDepfile(file.GetContents(), deps)) {
+		warnx("Malformed depfile '%s'", depfile.c_str());
+		depsLog->Forget(product);
+		return;
+	}
+
+	std::vector<Path> paths;
+	for (Path dep : deps) {
+		if (dep.is_relative())
+			dep = c->GetWorkDir() / dep;
+		paths.push_back(dep.lexically_normal());
+	}
+
+	depsLog->Record(product, paths);
+}
+
+void
+ProductManager::CheckParentExists(Product *product)
+{
+	PathId parentId = pathTree.GetParent(product->GetPathId());
+
+	if (!FindProduct(parentId)) {
+		Path parentPath(pathTree.GetPath(parentId));
+		if (!FileExists(parentPath)) {
+			errx(1, "No command to make product '%s', needed by '%s'",
+				parentPath.c_str(), product->GetPath().c_str());
+		}
+	}
+}
+
+/*
+ * Collect everything that might be needed to build the roots, before the
+ * graph is frozen.  This includes parent directories, and the contents of
+ * directory inputs that have an aggregate.
+ */
+void
+ProductManager::CollectInputs(std::unordered_set<Product*> & set,
+    const std::vector<Product*> & roots)
+{
+	std::vector<Product*> stack;
+
+	auto visit = [&set, &stack](Product * p)
+	{
+		if (set.insert(p).second)
+			stack.push_back(p);
+	};
+
+	graph.SortEdges();
+	for (Product *p : roots) {
+		visit(p);
+	}
+
+	while (!stack.empty()) {
+		Product * p = stack.back();
+		stack.pop_back();
+
+		graph.ForEachInput(p, visit);
+
+		if (!p->IsAggregate()) {
+			Product * parent = FindProduct(pathTree.GetParent(p->GetPathId()));
+			if (parent)
+				visit(parent);
+		}
+
+		auto it = aggregates.find(p);
+		if (it != aggregates.end())
+			visit(it->second.get());
+	}
+}
+
+void
+ProductManager::FindUnmadeInputs(const std::unordered_set<std::string_view> &targets,
+    std::vector<Path> & inputs, std::vector<Path> & parents)
+{
+	std::unordered_set<Product*> visited;
+	std::vector<Product*> stack;
+
+	auto visitInput = [&visited, &stack, &inputs](Product * p)
+	{
+		if (!p->GetCommand())
+			inputs.push_back(p->GetPath());
+		else if (visited.insert(p).second)
+			stack.push_back(p);
+	};
+
+	graph.SortEdges();
+	for (auto targetName : targets) {
+		const NamedTarget * target = FindTarget(std::string(targetName));
+		if (!target)
+			continue;
+
+		for (Product *p : target->GetDependees())
+			visitInput(p);
+	}
+
+	while (!stack.empty()) {
+		Product * p = stack.back();
+		stack.pop_back();
+
+		graph.ForEachInput(p, visitInput);
+
+		Product * parent = FindProduct(pathTree.GetParent(p->GetPathId()));
+		if (!parent || !parent->GetCommand())
+			parents.push_back(p->GetPath().parent_path());
+		else if (visited.insert(parent).second)
+			stack.push_back(parent);
+	}
+}
+
+void
+ProductManager::CollectInputTree(std::unordered_set<Product*> & set,
+    const std::vector<Product*> & roots)
+{
+	std::vector<Product*> stack;
+
+	for (Product *p : roots) {
+		if (set.insert(p).second)
+			stack.push_back(p);
+	}
+
+	while (!stack.empty()) {
+		Product * p = stack.back();
+		stack.pop_back();
+
+// 		fprintf(stderr, "Added '%s' to product set\n", p->GetPath().c_str());
+		if (!p->IsAggregate() && !IsDiscoveredSource(p))
+			CheckParentExists(p);
+		for (Product *input : p->GetInputs()) {
+			if (set.insert(input).second)
+				stack.push_back(input);
+		}
+	}
+}
+
+void
+ProductManager::SubmitLeafJobs(const std::unordered_set<std::string_view> &targets)
+{
+	std::vector<Product*> roots;
+
+	for (auto targetName : targets) {
+		auto it = targetMap.find(std::string(targetName));
+		if (it == targetMap.end()) {
+			errx(1, "No such target '%s'", targetName.data());
+		}
+
+		for (Product *p : it->second.GetDependees()) {
+			roots.push_back(p);
+		}
+	}
+
+	AddLoggedDeps();
+
+	/*
+	 * Only probe what the targets can reach.  We can't tell which inputs
+	 * are directories until they're probed, and the contents of those
+	 * directories can lead to more inputs, so repeat until no new
+	 * directories turn up.
+	 */
+	std::unordered_set<Product*> reachable;
+	std::vector<Product*> next(roots);
+	while (!next.empty()) {
+		CollectInputs(reachable, next);
+		ProbeProducts(reachable);
+		next = CalcDeps(reachable);
+	}
+
+	FreezeGraph();
+	CheckCycles(roots);
+
+	std::unordered_set<Product*> targetProducts;
+	CollectInputTree(targetProducts, roots);
+	ProbeProducts(targetProducts);
+	UpdateAggregateStatus();
+	FindHollowProducts(targetProducts);
+
+	if (digests)
+		PrefetchDigests(targetProducts);
+
+	/* The log and the graph may have changed since the last build. */
+	loggedAccesses.clear();
+	for (Product *product : targetProducts) {
+		CheckNeedsBuild(product);
+	}
+
+	RecreateHollowInputs(targetProducts);
+	InitPending(targetProducts);
+	TrackEphemeral(targetProducts, roots);
+	PrioritizeCommands(targetProducts);
+
+	for (Product *product : targetProducts) {
+
+		if (product->NeedsBuild() && product->IsReady()) {
+// 			fprintf(stderr, "%s is ready\n", product->GetPath().c_str());
+			ProductReady(product);
+		} else if (product->NeedsBuild()) {
+// 			fprintf(stderr, "'%s' needs build but inputs are not built\n", product->GetPath().c_str());
+		}
+	}
+}
+
+bool
+ProductManager::IsEphemeral(Product * product)
 {
+	Command * c = product->GetCommand();
+
+	return c && c->IsEphemeral();
 }
 
-Product *
-ProductManager::MakeProduct(const Path & path)
+/*
+ * A missing ephemeral product is hollow if a dependee exists.  It is taken
+ * to be as old as the oldest of them, so that it is only stale if one of
+ * its own inputs changed since they were built.  Returns false if the
+ * product is simply missing.
+ */
+bool
+ProductManager::MakeHollow(Product * product)
 {
-	auto product = std::make_unique<Product>(path, *this);
-	Product * ptr = product.get();
-	products.insert(std::make_pair(path, std::move(product)));
+	FileStat status;
+
+	if (hollowProducts.count(product) != 0)
+		return true;
+	if (product->NeedsBuild())
+		return false;
+
+	for (Product *d : product->GetDependees()) {
+		if (d->IsAggregate())
+			continue;
 
-	auto productStatus = fs::status(path);
+		if (!d->GetStatus().exists &&
+		    !(IsEphemeral(d) && MakeHollow(d)))
+			continue;
 
-	if (!fs::exists(productStatus)) {
-		ptr->SetNeedsBuild();
-	} else if (fs::is_directory(productStatus)) {
-		ptr->SetDirectory();
-		directories.push_back(ptr);
+		if (!status.exists || d->GetModifyTime() < status.mtime)
+			status.mtime = d->GetModifyTime();
+		status.exists = true;
 	}
 
-	return ptr;
+	if (!status.exists) {
+		product->SetNeedsBuild();
+		return false;
+	}
+
+	product->SetStatus(status);
+	hollowProducts.insert(product);
+	return true;
 }
 
-Product *
-ProductManager::GetProduct(const Path & path, bool makeParent)
+/*
+ * Ephemeral products are only deleted once every dependee is up to date
+ * with them, so one that is missing doesn't make its dependees stale.
+ */
+void
+ProductManager::FindHollowProducts(const std::unordered_set<Product*> & products)
 {
-	bool madeProduct = false;
-
-	Product * product = FindProduct(path);
-	if (product == nullptr) {
-		product = MakeProduct(path);
-		madeProduct = true;
+	for (Product *product : products) {
+		if (IsEphemeral(product) && !product->GetStatus().exists)
+			MakeHollow(product);
 	}
+}
 
-	if (makeParent) {
-		Product * parent = GetProduct(path.parent_path(), false);
-		if (parent->SetDirectory()) {
-			directories.push_back(parent);
+/*
+ * A hollow product has to be rebuilt before anything that reads it can
+ * run.  It will be the same as what its dependees read last time, so that
+ * doesn't make them stale.  Its other dependees now wait for it as well,
+ * and they may have hollow inputs too, so repeat until nothing changes.
+ */
+void
+ProductManager::RecreateHollowInputs(const std::unordered_set<Product*> & products)
+{
+	bool recreated;
+
+	if (hollowProducts.empty())
+		return;
+
+	do {
+		recreated = false;
+		for (Product *product : products) {
+			if (!product->NeedsBuild())
+				continue;
+
+			for (Product *input : product->GetInputs()) {
+				if (input->NeedsBuild() ||
+				    hollowProducts.count(input) == 0)
+					continue;
+
+				recreatedProducts.insert(input);
+				input->MarkStale();
+				recreated = true;
+			}
 		}
+	} while (recreated);
+}
 
-		if (madeProduct) {
-			dirContentsMap[parent].push_back(product);
+/*
+ * Count the dependees that each ephemeral product has to wait for before
+ * it can be deleted.  Products that were asked for directly, or that a
+ * command outside of the targets reads, are kept, as are those that are
+ * read through a directory, since the aggregate hides who reads them.
+ */
+void
+ProductManager::TrackEphemeral(const std::unordered_set<Product*> & products,
+    const std::vector<Product*> & roots)
+{
+	for (Product *product : products) {
+		if (!IsEphemeral(product) || product->IsDirectory() ||
+		    product->GetDependees().empty())
+			continue;
+
+		if (hollowProducts.count(product) != 0 && !product->NeedsBuild())
+			continue;
+
+		if (std::find(roots.begin(), roots.end(), product) != roots.end())
+			continue;
+
+		uint32_t consumers = 0;
+		bool keep = false;
+		for (Product *d : product->GetDependees()) {
+			if (d->IsAggregate() || !d->IsScheduled()) {
+				keep = true;
+				break;
+			}
+
+			if (d->NeedsBuild())
+				consumers++;
 		}
-	}
 
-	return product;
+		if (keep)
+			continue;
+
+		if (consumers == 0)
+			RemoveEphemeral(product);
+		else
+			ephemeralConsumers[product] = consumers;
+	}
 }
 
-Product *
-ProductManager::FindProduct(const Path &path)
+void
+ProductManager::RemoveEphemeral(Product * product)
 {
-	auto it = products.find(path);
-	if (it != products.end()) {
-		return it->second.get();
-	}
 
-	return nullptr;
+	if (unlink(product->GetPath().c_str()) != 0 && errno != ENOENT)
+		warn("Could not remove ephemeral product '%s'", product->GetPath().c_str());
 }
 
 void
-ProductManager::AddDependency(Product * product, Product * input)
+ProductManager::InputsConsumed(Product *product)
 {
-	if (product == input)
+
+	if (ephemeralConsumers.empty())
 		return;
 
-	product->AddDependency(input);
-// 	fprintf(stderr, "%s depends on %s\n", product->GetPath().c_str(), input->GetPath().c_str());
+	for (Product *input : product->GetInputs()) {
+		auto it = ephemeralConsumers.find(input);
+		if (it == ephemeralConsumers.end())
+			continue;
+
+		if (--it->second == 0) {
+			RemoveEphemeral(input);
+			ephemeralConsumers.erase(it);
+		}
+	}
 }
 
-bool
-ProductManager::CheckNeedsBuild(Product * product, const Product * input)
+/*
+ * Only products needed by the requested targets are scheduled; each waits
+ * for the inputs that need to be built first.
+ */
+void
+ProductManager::InitPending(const std::unordered_set<Product*> & products)
 {
+	for (Product *product : products) {
+		uint32_t count = 0;
 
-	if (input->NeedsBuild()) {
-// 		fprintf(stderr, "'%s' needs build because '%s' needs build\n", product->GetPath().c_str(), input->GetPath().c_str());
-		product->SetNeedsBuild();
-		return true;
+		for (Product *input : product->GetInputs()) {
+			if (input->NeedsBuild())
+				count++;
+		}
+
+		graph.SetPending(product->GetGraphIndex(), count);
 	}
+}
 
-	try {
-		const auto & productStatus = product->GetStatus();
-		if (!fs::exists(productStatus)) {
-// 			fprintf(stderr, "'%s' needs build because it doesn't exist\n", product->GetPath().c_str());
-			product->SetNeedsBuild();
-			return true;
-		}
+/*
+ * Estimate how long it will take to build every target from when each
+ * command that needs to run starts, by walking the products from the
+ * targets down to their inputs.  Commands that have never succeeded are
+ * assumed to take as long as the average one in this build does.
+ */
+void
+ProductManager::PrioritizeCommands(const std::unordered_set<Product*> & products)
+{
+	std::unordered_map<Product*, uint32_t> waiting;
+	std::unordered_map<Product*, uint64_t> remaining;
+	std::unordered_map<Command*, uint64_t> durations;
+	std::vector<Command*> unknown;
+	std::vector<Product*> ready;
+	uint64_t knownTotal = 0;
+
+	for (Product *product : products) {
+		if (!product->NeedsBuild())
+			continue;
 
-		if (fs::is_directory(productStatus)) {
-			/* A directory can not be rebuilt, so if it already exists, we are done. */
-			return false;
+		uint32_t count = 0;
+		for (Product *dependee : product->GetDependees()) {
+			if (dependee->NeedsBuild() && products.count(dependee))
+				count++;
 		}
 
-		const auto & inputStatus = input->GetStatus();
-		if (!fs::exists(inputStatus)) {
-// 			fprintf(stderr, "'%s' needs build because '%s' doesn't exist\n", product->GetPath().c_str(), input->GetPath().c_str());
-			product->SetNeedsBuild();
-			return true;
+		waiting[product] = count;
+		if (count == 0)
+			ready.push_back(product);
+
+		Command *c = product->GetCommand();
+		if (c && durations.count(c) == 0) {
+			uint64_t msec = 0;
+
+			if (history && history->GetDuration(*c, msec))
+				knownTotal += msec;
+			else
+				unknown.push_back(c);
+			durations[c] = msec;
+			c->SetPriority(0, 0);
 		}
+	}
 
-		if (fs::is_directory(inputStatus)) {
-			/*
-			 * Directories are updated when any file in them is
-			 * written to; do not rebuild if object is older than
-			 * a directory it depends on as that's likely a false
-			 * dependency.
-			 */
-			return false;
+	size_t known = durations.size() - unknown.size();
+	uint64_t mean = known > 0 ? std::max(knownTotal / known, uint64_t(1)) : 1;
+	for (Command *c : unknown)
+		durations[c] = mean;
+
+	while (!ready.empty()) {
+		Product *product = ready.back();
+		ready.pop_back();
+
+		uint64_t path = 0;
+		uint32_t fanOut = 0;
+		for (Product *dependee : product->GetDependees()) {
+			auto it = remaining.find(dependee);
+			if (it != remaining.end()) {
+				path = std::max(path, it->second);
+				fanOut++;
+			}
 		}
 
-		auto inputLast = input->GetModifyTime();
-		auto productLast = product->GetModifyTime();
+		Command *c = product->GetCommand();
+		if (c) {
+			path += durations[c];
+			c->SetPriority(std::max(path, c->GetCriticalPath()),
+			    c->GetFanOut() + fanOut);
+		}
+		remaining[product] = path;
 
-		if (productLast < inputLast) {
-// 			fprintf(stderr, "'%s' needs build because it is older than '%s'\n", product->GetPath().c_str(), input->GetPath().c_str());
-			product->SetNeedsBuild();
-			return true;
+		for (Product *input : product->GetInputs()) {
+			auto it = waiting.find(input);
+			if (it != waiting.end() && --it->second == 0)
+				ready.push_back(input);
 		}
-	} catch (fs::filesystem_error &e) {
-// 		fprintf(stderr, "'%s' needs build because we got an error accessing it: %s\n", product->GetPath().c_str(), e.what());
-		product->SetNeedsBuild();
-		return true;
 	}
-	return false;
 }
 
-bool
-ProductManager::FileExists(const Path & path)
+void
+ProductManager::PrefetchDigests(const std::unordered_set<Product*> & products)
 {
-	/*
-	 * XXX The parent path of "foo" is "", which doesn't test as existing.
-	 * Pretend that is does and hope for the best.
-	 */
-	if (path.empty()) {
-		return true;
-	}
+	std::unordered_set<Product*> inputs;
+	std::vector<Path> paths;
 
-	std::error_code error;
+	for (Product *product : products) {
+		if (product->IsAggregate())
+			continue;
 
-	return fs::exists(path, error) && !error;
+		std::vector<Product*> files;
+		CollectFileInputs(product, files);
+		for (Product *input : files) {
+			if (inputs.insert(input).second)
+				paths.push_back(input->GetPath());
+		}
+	}
+
+	digests->Prefetch(paths);
 }
 
 void
-ProductManager::SetInputs(Product * product, std::vector<Product*> inputs)
+ProductManager::ProductReady(Product *p)
 {
-	for (Product *input : inputs) {
-		dependeeMap[input].push_back(product);
-	}
+	if (!p->NeedsBuild())
+		return;
 
-	std::vector<Product*> & mapInputs = inputMap[product];
-	if (mapInputs.empty()) {
-		mapInputs = std::move(inputs);
-	} else {
-		for (Product * p : inputs) {
-			mapInputs.push_back(p);
-		}
-	}
+	if (CanCutOff(p))
+		CutOff(p);
+	else
+		SubmitProductJob(p);
 }
 
-void
-ProductManager::CheckNeedsBuild(Product * product)
+/*
+ * A product can be skipped if none of the inputs that it was waiting on
+ * changed, as long as that is also true of everything else its command
+ * makes; we can't run the command for only some of its products.
+ */
+bool
+ProductManager::CanCutOff(Product *p)
 {
-	if (product->NeedsBuild())
-		return;
+	if (p->IsStale())
+		return false;
 
-	for (const Product * input : product->GetInputs()) {
-		if(CheckNeedsBuild(product, input))
-			return;
+	if (p->IsAggregate())
+		return true;
+
+	Command *c = p->GetCommand();
+	if (!c || c->WasQueued())
+		return false;
+
+	for (Product *sibling : c->GetProducts()) {
+		if (!sibling->NeedsBuild() || !sibling->IsScheduled())
+			continue;
+
+		if (sibling->IsStale() || !sibling->IsReady())
+			return false;
 	}
+
+	return true;
 }
 
 void
-ProductManager::AddDirProducts(Product *dir, std::unordered_set<Product*> & dirContents)
+ProductManager::CutOff(Product *p)
 {
+	/*
+	 * In mtime mode the product is now older than an input that was
+	 * rebuilt, so bring it up to date or the next build will think that
+	 * it is stale.
+	 */
+	if (!digests && !p->IsAggregate() && !p->IsDirectory()) {
+		struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
 
-	for (Product *p : dirContentsMap[dir]) {
-		if (p->IsDirectory()) {
-			AddDirProducts(p, dirContents);
-		} else {
-			dirContents.insert(p);
-		}
+		if (utimensat(AT_FDCWD, p->GetPath().c_str(), times, 0) != 0)
+			warn("Could not update modification time of '%s'", p->GetPath().c_str());
 	}
+
+	p->Complete(false);
 }
 
+/*
+ * Remember what the products of a restat command looked like before the
+ * command runs, so that ProductChanged() can tell if it rewrote them with
+ * the same contents.
+ */
 void
-ProductManager::CalcDeps()
+ProductManager::RecordRestatDigests(Command *c)
 {
-	for (Product *dir : directories) {
-		if (dependeeMap[dir].empty()) {
+	for (Product *product : c->GetProducts()) {
+		const FileStat & st = product->GetStatus();
+		uint64_t digest;
+
+		if (!st.exists || st.isDirectory)
 			continue;
-		}
 
-// 		fprintf(stderr, "Enumerate '%s' for '%s'\n", dir->GetPath().c_str(),
-// 		     dependeeMap[dir].front()->GetPath().c_str());
-		std::unordered_set<Product*> dirContents;
+		if (DigestFile(product->GetPath(), digest))
+			restatDigests[product] = digest;
+	}
+}
 
-		using opt = fs::directory_options;
-		std::error_code error;
-		auto dirIt = fs::recursive_directory_iterator(dir->GetPath(),
-		    opt::skip_permission_denied | opt::follow_directory_symlink,
-		    error);
+bool
+ProductManager::ProductChanged(Product *product)
+{
+	Command *c = product->GetCommand();
 
-		if (!error) {
-			for (auto & entry : dirIt) {
-				if (!fs::is_directory(entry.path())) {
-					dirContents.insert(GetProduct(entry.path(), false));
-				}
-			}
-		}
+	if (recreatedProducts.count(product) != 0)
+		return false;
 
-		AddDirProducts(dir, dirContents);
+	if (!c || !c->GetRestat())
+		return true;
 
-		for (Product *dependee : dependeeMap[dir]) {
-			for (Product *input : dirContents) {
-				AddDependency(dependee, input);
-// 				fprintf(stderr, "'%s' depends on dir contents '%s'\n",
-// 				    dependee->GetPath().c_str(),
-// 				    input->GetPath().c_str());
-			}
-		}
-	}
+	FileStat old = product->GetStatus();
+	product->ProbeStatus();
+	const FileStat & st = product->GetStatus();
 
-	for (auto & [product, inputs] : inputMap) {
-		for (Product *input : inputs) {
-			if (!input->IsDirectory()) {
-				AddDependency(product, input);
-// 				fprintf(stderr, "'%s' depends on dir contents '%s'\n",
-// 				    product->GetPath().c_str(),
-// 				    input->GetPath().c_str());
-			}
-		}
-	}
+	if (!old.exists || !st.exists || st.isDirectory)
+		return true;
+
+	if (old.dev == st.dev && old.ino == st.ino && old.size == st.size &&
+	    old.mtime == st.mtime)
+		return false;
+
+	auto it = restatDigests.find(product);
+	if (it == restatDigests.end() || old.size != st.size)
+		return true;
+
+	uint64_t digest;
+	if (!DigestFile(product->GetPath(), digest))
+		return true;
+
+	return digest != it->second;
 }
 
 void
-ProductManager::CollectParentInputs(Product *product)
+ProductManager::ProductBuilt(Product *product)
 {
-	Path parentPath(product->GetPath().parent_path());
-	Product * parent = FindProduct(parentPath);
+	std::vector<Product*> files;
 
-	if (parent) {
-		AddDependency(product, parent);
-	} else if (!FileExists(parentPath)) {
-		errx(1, "No command to make product '%s', needed by '%s'",
-			parentPath.c_str(), product->GetPath().c_str());
-	}
+	if (digests)
+		CollectFileInputs(product, files);
+
+	ProductBuilt(product, files);
 }
 
 void
-ProductManager::CollectInputTree(std::unordered_set<Product*> & set, Product *p)
+ProductManager::ProductBuilt(Product *product, const std::vector<Product*> & files)
 {
-	auto [it, success] = set.insert(p);
-	if (success) {
-// 		fprintf(stderr, "Added '%s' to product set\n", p->GetPath().c_str());
-		CollectParentInputs(p);
-		for (Product *input : p->GetInputs()) {
-			CollectInputTree(set, input);
-		}
+	Command *c = product->GetCommand();
+
+	if (accessLog && c && product == c->GetProducts().front()) {
+		if (c->AccessesTracked())
+			accessLog->Record(product->GetPath(), c->GetAccesses());
+		else
+			accessLog->Forget(product->GetPath());
 	}
+
+	if (depsLog && c && c->GetDepfile() && product == c->GetProducts().front())
+		IngestDepfile(c);
+
+	if (!digests)
+		return;
+
+	std::vector<Path> inputs;
+	GetRecordedInputs(product, files, inputs);
+	digests->RecordBuild(product->GetPath(), inputs);
 }
 
 void
-ProductManager::SubmitLeafJobs(const std::unordered_set<std::string_view> &targets)
+ProductManager::GetRecordedInputs(Product *product,
+    const std::vector<Product*> & files, std::vector<Path> & inputs)
 {
-	CalcDeps();
-
-	std::unordered_set<Product*> targetProducts;
-
-	for (auto targetName : targets) {
-		auto it = targetMap.find(std::string(targetName));
-		if (it == targetMap.end()) {
-			errx(1, "No such target '%s'", targetName.data());
-		}
+	Command *c = product->GetCommand();
 
-		for (Product *p : it->second.GetDependees()) {
-			CollectInputTree(targetProducts, p);
-		}
+	for (Product *input : files) {
+		inputs.push_back(input->GetPath());
 	}
 
-	for (Product *product : targetProducts) {
-		CheckNeedsBuild(product);
-	}
+	/* What the depfile reported isn't in the graph until the next build. */
+	if (depsLog && c && c->GetDepfile())
+		depsLog->GetDeps(c->GetProducts().front()->GetPath(), inputs);
+}
 
-	for (Product *product : targetProducts) {
+void
+ProductManager::BuildStarting(Product *product, const std::vector<Product*> & files)
+{
+	std::vector<Path> inputs;
 
-		if (product->NeedsBuild() && product->IsReady()) {
-// 			fprintf(stderr, "%s is ready\n", product->GetPath().c_str());
-			SubmitProductJob(product);
-		} else if (product->NeedsBuild()) {
-// 			fprintf(stderr, "'%s' needs build but inputs are not built\n", product->GetPath().c_str());
-		}
-	}
+	if (!digests)
+		return;
+
+	GetRecordedInputs(product, files, inputs);
+	digests->BuildStarted(product->GetPath(), inputs);
 }
 
 void
-ProductManager::ProductReady(Product *p)
+ProductManager::BuildStarting(Command *c)
 {
-	if (p->NeedsBuild())
-		SubmitProductJob(p);
+	for (Product *product : c->GetProducts()) {
+		std::vector<Product*> files;
+
+		CollectFileInputs(product, files);
+		BuildStarting(product, files);
+	}
 }
 
 void
 ProductManager::SubmitProductJob(Product *product)
 {
+	if (product->IsAggregate()) {
+		product->Complete(true);
+		return;
+	}
+
 	Command * c = product->GetCommand();
 
 	if (!c) {
@@ -351,14 +1386,20 @@ ProductManager::SubmitProductJob(Product *product)
 		    product->GetPath().c_str(), dependee->GetPath().c_str());
 	}
 
+	if (c->GetRestat() && !c->WasQueued())
+		RecordRestatDigests(c);
+
+	if (digests && !c->WasQueued())
+		BuildStarting(c);
+
 	jobQueue.Submit(c);
 }
 
 void
 ProductManager::CheckBlockedCommands()
 {
-	for (auto & [path, product] : products) {
-		if (IsBlocked(product.get()))
+	for (auto & product : products) {
+		if (product && IsBlocked(product.get()))
 			ReportCycle(product.get());
 	}
 }
@@ -367,9 +1408,15 @@ bool
 ProductManager::IsBlocked(Product *product)
 {
 
-	if (!product->NeedsBuild())
+	if (!product->NeedsBuild() || !product->IsScheduled() ||
+	    product->IsComplete())
 		return false;
 
+	if (product->IsAggregate()) {
+		/* Aggregates complete as soon as their inputs do. */
+		return !product->IsReady();
+	}
+
 	if (!product->IsBuildable()) {
 		/*
 		 * Could happen if we have a dependency cycle and are
@@ -415,6 +1462,83 @@ ProductManager::ReportCycle(Product *product)
 	errx(1, "Build terminated due to cycle");
 }
 
+/*
+ * Report every dependency cycle that the targets can reach before any job
+ * is started, instead of finding out when the build stalls.
+ */
+void
+ProductManager::CheckCycles(const std::vector<Product*> & roots)
+{
+	std::vector<std::vector<Product*>> cycles = graph.FindCycles(roots);
+
+	if (cycles.empty())
+		return;
+
+	for (const auto & component : cycles) {
+		PrintCycle(component);
+	}
+
+	errx(1, "Build terminated due to %zu dependency cycle%s", cycles.size(),
+	    cycles.size() == 1 ? "" : "s");
+}
+
+/*
+ * Print the shortest path from the first product in the component back to
+ * itself.  Every product in a component is on some cycle, so a breadth-first
+ * search that stays in the component is guaranteed to find one.
+ */
+void
+ProductManager::PrintCycle(const std::vector<Product*> & component)
+{
+	std::unordered_map<Product*, Product*> parent;
+	std::vector<Product*> queue;
+	Product * start = component.front();
+	Product * last = nullptr;
+
+	for (Product * p : component) {
+		parent.emplace(p, nullptr);
+	}
+
+	queue.push_back(start);
+	for (size_t i = 0; i < queue.size() && !last; ++i) {
+		Product * p = queue[i];
+
+		for (Product * input : p->GetInputs()) {
+			if (input == start) {
+				last = p;
+				break;
+			}
+
+			auto it = parent.find(input);
+			if (it == parent.end() || it->second != nullptr)
+				continue;
+
+			it->second = p;
+			queue.push_back(input);
+		}
+	}
+
+	/* Should be impossible. */
+	if (last == nullptr)
+		errx(1, "Couldn't find cycle");
+
+	std::vector<Product*> path;
+	for (Product * p = last; p != start; p = parent[p]) {
+		path.push_back(p);
+	}
+
+	fprintf(stderr, "Dependency cycle through '%s'\n", start->GetPath().c_str());
+	for (auto it = path.rbegin(); it != path.rend(); ++it) {
+		fprintf(stderr, "\tDepends on %s\n", (*it)->GetPath().c_str());
+	}
+	fprintf(stderr, "\tDepends on %s\n", start->GetPath().c_str());
+
+	if (component.size() > path.size() + 1) {
+		fprintf(stderr, "\t(%zu products in total are part of this cycle)\n",
+		    component.size());
+	}
+}
+
 void
 ProductManager::AddToTarget(std::string_view n, Product *p)
 {
@@ -430,3 +1554,13 @@ ProductManager::AddToTarget(std::string_view n, Product *p)
 
 	it->second.AddDependee(p);
 }
+
+const NamedTarget *
+ProductManager::FindTarget(const std::string & name) const
+{
+	auto it = targetMap.find(name);
+	if (it == targetMap.end())
+		return nullptr;
+
+	return &it->second;
+}
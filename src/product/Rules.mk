@@ -2,8 +2,30 @@
 LIB := product
 
 SRCS := \
+	AccessLog.cpp \
 	Command.cpp \
 	CommandFactory.cpp \
+	DepGraph.cpp \
+	DepsLog.cpp \
+	DigestDatabase.cpp \
+	GraphCache.cpp \
+	JobHistory.cpp \
+	Manifest.cpp \
 	Product.cpp \
 	ProductManager.cpp \
 
+TESTS := \
+	DepGraph \
+	Manifest \
+
+TEST_DEPGRAPH_SRCS := \
+	DepGraph.cpp \
+
+TEST_DEPGRAPH_LIBS := \
+	product \
+	job \
+	perm \
+	util \
+
+TEST_MANIFEST_SRCS := \
+	Manifest.cpp \
@@ -1,5 +1,10 @@
 
 objdirprefix = "/tmp/obj/tcplat"
+
+-- Each configuration given with -c builds into its own object tree.
+if factory.configuration then
+	objdirprefix = factory.build_path(objdirprefix, factory.configuration.name)
+end
 libdir = objdirprefix .. "/lib"
 bindir = objdirprefix .. "/bin"
 
@@ -37,6 +42,7 @@ definitions = {
 
 				objname = factory.replace_ext(src, "[a-zA-Z0-9]+", "o")
 				objpath = factory.build_path(objdir, objname)
+				deppath = objpath .. ".d"
 
 				arglist = factory.flat_list(
 					parent_config["CXX"],
@@ -44,6 +50,7 @@ definitions = {
 					"-O2",
 					"-Wall",
 					"-g",
+					"-MD", "-MF", deppath,
 					"-o", objpath,
 					"-I", include_path,
 					srcpath)
@@ -63,7 +70,8 @@ definitions = {
 				}
 
 				options = {
-					tmpdirs = objdir
+					tmpdirs = objdir,
+					depfile = deppath
 				}
 				factory.define_command({objpath}, inputs, arglist, options)
 
@@ -0,0 +1,139 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Depfile.h"
+
+namespace
+{
+class DepfileParser
+{
+	std::vector<std::string> & deps;
+	std::string token;
+	bool inPrereqs;
+	bool sawTarget;
+
+	void EndToken()
+	{
+		if (token.empty())
+			return;
+
+		if (inPrereqs) {
+			deps.push_back(std::move(token));
+		} else {
+			/* Everything up to the first colon is a target. */
+			size_t colon = token.find(':');
+			if (colon != std::string::npos) {
+				inPrereqs = true;
+				if (colon + 1 < token.size())
+					deps.push_back(token.substr(colon + 1));
+			} else {
+				sawTarget = true;
+			}
+		}
+
+		token.clear();
+	}
+
+	bool EndLine()
+	{
+		EndToken();
+
+		/* A line with targets must have a colon after them. */
+		if (sawTarget && !inPrereqs)
+			return false;
+
+		inPrereqs = false;
+		sawTarget = false;
+		return true;
+	}
+
+public:
+	explicit DepfileParser(std::vector<std::string> & d)
+	  : deps(d),
+	    inPrereqs(false),
+	    sawTarget(false)
+	{
+	}
+
+	bool Parse(std::string_view contents)
+	{
+		size_t len = contents.size();
+
+		for (size_t i = 0; i < len; ++i) {
+			char c = contents[i];
+
+			switch (c) {
+			case '\\':
+				if (i + 1 < len && contents[i + 1] == '\n') {
+					/* Line continuation. */
+					EndToken();
+					i++;
+				} else if (i + 2 < len && contents[i + 1] == '\r' &&
+				    contents[i + 2] == '\n') {
+					EndToken();
+					i += 2;
+				} else if (i + 1 < len &&
+				    (contents[i + 1] == ' ' || contents[i + 1] == '#')) {
+					token += contents[i + 1];
+					i++;
+				} else {
+					token += c;
+				}
+				break;
+			case '$':
+				token += c;
+				if (i + 1 < len && contents[i + 1] == '$')
+					i++;
+				break;
+			case ' ':
+			case '\t':
+			case '\r':
+				EndToken();
+				break;
+			case '\n':
+				if (!EndLine())
+					return false;
+				break;
+			default:
+				token += c;
+				break;
+			}
+		}
+
+		return EndLine();
+	}
+};
+}
+
+bool
+ParseDepfile(std::string_view contents, std::vector<std::string> & deps)
+{
+	DepfileParser parser(deps);
+
+	return parser.Parse(contents);
+}
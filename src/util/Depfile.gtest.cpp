@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Depfile.h"
+
+#include <gtest/gtest.h>
+
+class DepfileTestSuite : public ::testing::Test
+{
+};
+
+typedef std::vector<std::string> StringList;
+
+TEST_F(DepfileTestSuite, TestSimple)
+{
+	StringList deps;
+
+	ASSERT_TRUE(ParseDepfile("foo.o: foo.c foo.h\n", deps));
+	EXPECT_EQ(deps, StringList({"foo.c", "foo.h"}));
+}
+
+TEST_F(DepfileTestSuite, TestContinuation)
+{
+	StringList deps;
+
+	ASSERT_TRUE(ParseDepfile("foo.o: foo.c \\\n  /usr/include/stdio.h \\\r\n bar.h", deps));
+	EXPECT_EQ(deps, StringList({"foo.c", "/usr/include/stdio.h", "bar.h"}));
+}
+
+TEST_F(DepfileTestSuite, TestPhonyTargets)
+{
+	StringList deps;
+
+	/* -MP adds an empty rule for every header. */
+	ASSERT_TRUE(ParseDepfile("foo.o: foo.c foo.h\n\nfoo.h:\n", deps));
+	EXPECT_EQ(deps, StringList({"foo.c", "foo.h"}));
+}
+
+TEST_F(DepfileTestSuite, TestEscapes)
+{
+	StringList deps;
+
+	ASSERT_TRUE(ParseDepfile("foo.o: my\\ file.h has\\#hash.h cost$$.h c:\\dir\n", deps));
+	EXPECT_EQ(deps, StringList({"my file.h", "has#hash.h", "cost$.h", "c:\\dir"}));
+}
+
+TEST_F(DepfileTestSuite, TestMultipleTargets)
+{
+	StringList deps;
+
+	ASSERT_TRUE(ParseDepfile("foo.o foo.d :foo.c\n", deps));
+	EXPECT_EQ(deps, StringList({"foo.c"}));
+}
+
+TEST_F(DepfileTestSuite, TestMissingColon)
+{
+	StringList deps;
+
+	EXPECT_FALSE(ParseDepfile("foo.o foo.c\n", deps));
+}
+
+TEST_F(DepfileTestSuite, TestEmpty)
+{
+	StringList deps;
+
+	EXPECT_TRUE(ParseDepfile("", deps));
+	EXPECT_TRUE(deps.empty());
+}
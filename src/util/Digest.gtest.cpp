@@ -0,0 +1,66 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Digest.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+class DigestTestSuite : public ::testing::Test
+{
+};
+
+static uint64_t
+DigestString(const char * str, uint64_t seed = 0)
+{
+	return DigestBuffer(str, strlen(str), seed);
+}
+
+TEST_F(DigestTestSuite, TestEmpty)
+{
+	EXPECT_EQ(DigestString(""), 0xEF46DB3751D8E999ULL);
+}
+
+TEST_F(DigestTestSuite, TestShort)
+{
+	EXPECT_EQ(DigestString("abc"), 0x44BC2CF5AD770999ULL);
+}
+
+TEST_F(DigestTestSuite, TestLong)
+{
+	/* Long enough to go through the 32-byte stripe loop. */
+	EXPECT_EQ(DigestString("Nobody inspects the spammish repetition"),
+	    0xFBCEA83C8A378BF1ULL);
+}
+
+TEST_F(DigestTestSuite, TestSeed)
+{
+	EXPECT_NE(DigestString("abc", 1), DigestString("abc"));
+	EXPECT_EQ(DigestString("abc", 1), DigestString("abc", 1));
+}
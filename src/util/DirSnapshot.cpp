@@ -0,0 +1,245 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DirSnapshot.h"
+
+#include "ParallelFor.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Reading directories mostly waits on the filesystem, as with stat(). */
+#define WALK_THREADS_PER_CPU	4
+
+#define DIRENT_BUF_SIZE		(64 * 1024)
+
+bool
+DirSnapshot::IsDirectory(int dirfd, const char * name)
+{
+	struct stat sb;
+
+	if (fstatat(dirfd, name, &sb, 0) != 0)
+		return false;
+
+	return S_ISDIR(sb.st_mode);
+}
+
+void
+DirSnapshot::ReadDir(const Path & path, DirEntries & entries)
+{
+	struct stat sb;
+	int fd;
+
+	/*
+	 * Directories that can't be read are treated as empty, like
+	 * fs::directory_options::skip_permission_denied.
+	 */
+	fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		return;
+	}
+
+	entries.readable = true;
+	entries.dev = sb.st_dev;
+	entries.ino = sb.st_ino;
+
+	std::vector<char> buf(DIRENT_BUF_SIZE);
+	ssize_t len;
+	while ((len = getdents(fd, buf.data(), buf.size())) > 0) {
+		ssize_t off = 0;
+		while (off < len) {
+			const struct dirent *dp =
+			    reinterpret_cast<const struct dirent *>(&buf[off]);
+			off += dp->d_reclen;
+
+			if (dp->d_fileno == 0 || strcmp(dp->d_name, ".") == 0 ||
+			    strcmp(dp->d_name, "..") == 0)
+				continue;
+
+			bool isDir;
+			switch (dp->d_type) {
+			case DT_DIR:
+				isDir = true;
+				break;
+			case DT_LNK:
+			case DT_UNKNOWN:
+				/* Only these need a stat() to classify. */
+				isDir = IsDirectory(fd, dp->d_name);
+				break;
+			default:
+				isDir = false;
+				break;
+			}
+
+			if (isDir)
+				entries.subdirs.emplace_back(dp->d_name);
+			else
+				entries.files.emplace_back(dp->d_name);
+		}
+	}
+
+	close(fd);
+
+	std::sort(entries.files.begin(), entries.files.end());
+	std::sort(entries.subdirs.begin(), entries.subdirs.end());
+}
+
+void
+DirSnapshot::Walk(const std::vector<Path> & roots)
+{
+	std::vector<Path> frontier;
+
+	for (const Path & root : roots) {
+		if (dirs.count(root) == 0)
+			frontier.push_back(root);
+	}
+
+	/*
+	 * Read one level of the trees at a time; all directories in a level
+	 * are read in parallel.
+	 */
+	while (!frontier.empty()) {
+		std::vector<DirEntries> results(frontier.size());
+
+		ParallelFor(frontier.size(), [&frontier, &results](size_t i)
+			{
+				ReadDir(frontier[i], results[i]);
+			}, WALK_THREADS_PER_CPU);
+
+		std::vector<Path> next;
+		for (size_t i = 0; i < frontier.size(); ++i) {
+			auto [it, inserted] = dirs.emplace(frontier[i],
+			    std::move(results[i]));
+
+			/* The same root may have been listed twice. */
+			if (!inserted)
+				continue;
+
+			DirEntries & entries = it->second;
+			if (!entries.readable)
+				continue;
+
+			DirId id(entries.dev, entries.ino);
+			auto [idIt, newDir] = dirPaths.emplace(id, it->first);
+			if (!newDir) {
+				/*
+				 * Reached through a symlink (possibly a loop);
+				 * don't descend into it again.
+				 */
+				entries.aliasOf = idIt->second;
+				entries.files.clear();
+				entries.subdirs.clear();
+				continue;
+			}
+
+			for (const std::string & name : entries.subdirs) {
+				Path subdir(it->first / name);
+				if (dirs.count(subdir) == 0)
+					next.push_back(std::move(subdir));
+			}
+		}
+
+		frontier.swap(next);
+	}
+}
+
+DirSnapshot::DirMap::const_iterator
+DirSnapshot::Find(const Path & path) const
+{
+	auto it = dirs.find(path);
+	if (it != dirs.end() && !it->second.aliasOf.empty())
+		it = dirs.find(it->second.aliasOf);
+
+	return it;
+}
+
+/*
+ * A directory reachable through several paths (e.g. a symlink beside the
+ * real directory) is reported under each of them, as the commands reading
+ * it may use any of those paths.  Only a directory that is its own
+ * ancestor, i.e. a symlink loop, is cut short.
+ */
+void
+DirSnapshot::CollectFiles(const Path & dir, DirMap::const_iterator it,
+    DirIdSet & ancestors, std::vector<Path> & files) const
+{
+	if (it == dirs.end() || !it->second.readable)
+		return;
+
+	const DirEntries & entries = it->second;
+	DirId id(entries.dev, entries.ino);
+	if (!ancestors.insert(id).second)
+		return;
+
+	for (const std::string & name : entries.files) {
+		files.push_back(dir / name);
+	}
+
+	/*
+	 * Subdirectories are looked up under the path they were read from,
+	 * but reported under the path that the caller asked for.
+	 */
+	for (const std::string & name : entries.subdirs) {
+		CollectFiles(dir / name, Find(it->first / name), ancestors, files);
+	}
+
+	ancestors.erase(id);
+}
+
+void
+DirSnapshot::GetFiles(const Path & dir, std::vector<Path> & files) const
+{
+	DirIdSet ancestors;
+
+	CollectFiles(dir, Find(dir), ancestors, files);
+}
+
+bool
+DirSnapshot::Lookup(const Path & path, bool & exists) const
+{
+	auto it = Find(path.parent_path());
+	if (it == dirs.end() || !it->second.readable)
+		return false;
+
+	const DirEntries & entries = it->second;
+	std::string name(path.filename().string());
+
+	exists = std::binary_search(entries.files.begin(), entries.files.end(), name) ||
+	    std::binary_search(entries.subdirs.begin(), entries.subdirs.end(), name);
+	return true;
+}
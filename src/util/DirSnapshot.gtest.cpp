@@ -0,0 +1,164 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DirSnapshot.h"
+
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+class DirSnapshotTestSuite : public ::testing::Test
+{
+protected:
+	Path root;
+
+	void SetUp() override
+	{
+		char dir[] = "/tmp/DirSnapshot.XXXXXX";
+
+		ASSERT_NE(mkdtemp(dir), nullptr);
+		root = Path(dir);
+	}
+
+	void TearDown() override
+	{
+		std::error_code code;
+
+		std::filesystem::remove_all(root, code);
+	}
+
+	void MakeDir(const char * name)
+	{
+		ASSERT_EQ(mkdir((root / name).c_str(), 0755), 0);
+	}
+
+	void MakeFile(const char * name)
+	{
+		int fd = open((root / name).c_str(), O_WRONLY | O_CREAT, 0644);
+
+		ASSERT_GE(fd, 0);
+		close(fd);
+	}
+
+	void MakeLink(const char * target, const char * name)
+	{
+		ASSERT_EQ(symlink(target, (root / name).c_str()), 0);
+	}
+
+	std::vector<std::string> GetFiles(const DirSnapshot & snapshot,
+	    const char * dir)
+	{
+		std::vector<Path> files;
+		std::vector<std::string> names;
+
+		snapshot.GetFiles(*dir ? root / dir : root, files);
+		for (const Path & file : files) {
+			names.push_back(file.string().substr(root.string().size() + 1));
+		}
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+};
+
+typedef std::vector<std::string> StringList;
+
+TEST_F(DirSnapshotTestSuite, TestWalk)
+{
+	DirSnapshot snapshot;
+
+	MakeDir("src");
+	MakeDir("src/sub");
+	MakeDir("empty");
+	MakeFile("src/a.c");
+	MakeFile("src/sub/b.c");
+	MakeFile("top.txt");
+
+	snapshot.Walk({root});
+	EXPECT_EQ(GetFiles(snapshot, ""),
+	    StringList({"src/a.c", "src/sub/b.c", "top.txt"}));
+	EXPECT_EQ(GetFiles(snapshot, "src/sub"), StringList({"src/sub/b.c"}));
+	EXPECT_EQ(GetFiles(snapshot, "empty"), StringList());
+}
+
+TEST_F(DirSnapshotTestSuite, TestSymlinkAlias)
+{
+	DirSnapshot snapshot;
+
+	MakeDir("real");
+	MakeFile("real/f");
+	MakeLink("real", "link");
+	MakeLink(".", "loop");
+
+	/* Walking both the tree and a root under it reads nothing twice. */
+	snapshot.Walk({root, root / "real"});
+
+	/*
+	 * The directory is read once, but its files are listed under both
+	 * paths; the loop back to the root is not followed.
+	 */
+	EXPECT_EQ(GetFiles(snapshot, ""), StringList({"link/f", "real/f"}));
+
+	/* Asking for the link reports its files under the link. */
+	EXPECT_EQ(GetFiles(snapshot, "link"), StringList({"link/f"}));
+	EXPECT_EQ(GetFiles(snapshot, "real"), StringList({"real/f"}));
+}
+
+TEST_F(DirSnapshotTestSuite, TestLookup)
+{
+	DirSnapshot snapshot;
+	bool exists;
+
+	MakeDir("dir");
+	MakeFile("dir/file");
+	MakeLink("dir", "link");
+	snapshot.Walk({root});
+
+	ASSERT_TRUE(snapshot.Lookup(root / "dir/file", exists));
+	EXPECT_TRUE(exists);
+
+	ASSERT_TRUE(snapshot.Lookup(root / "dir", exists));
+	EXPECT_TRUE(exists);
+
+	ASSERT_TRUE(snapshot.Lookup(root / "dir/missing", exists));
+	EXPECT_FALSE(exists);
+
+	ASSERT_TRUE(snapshot.Lookup(root / "link/file", exists));
+	EXPECT_TRUE(exists);
+
+	/* Not covered by the walk. */
+	EXPECT_FALSE(snapshot.Lookup(root / "dir/file/x", exists));
+	EXPECT_FALSE(snapshot.Lookup(Path("/nonexistent/file"), exists));
+}
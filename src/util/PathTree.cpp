@@ -0,0 +1,149 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "PathTree.h"
+
+#include "HashUtil.h"
+
+#include <cstring>
+#include <string>
+
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+
+size_t
+PathTree::ChildKeyHash::operator()(const ChildKey & key) const
+{
+	return fnv1a_hash(key.name, fnv1a_hash(std::string_view(
+	    reinterpret_cast<const char *>(&key.parent), sizeof(key.parent))));
+}
+
+PathTree::PathTree()
+  : arenaUsed(ARENA_BLOCK_SIZE)
+{
+	nodes.push_back({ROOT, std::string_view()});
+}
+
+std::string_view
+PathTree::Store(std::string_view name)
+{
+
+	if (name.size() > ARENA_BLOCK_SIZE) {
+		/* Oversized names get a block to themselves. */
+		arena.emplace_back(new char[name.size()]);
+		memcpy(arena.back().get(), name.data(), name.size());
+		std::string_view stored(arena.back().get(), name.size());
+
+		/* Keep filling the previous block. */
+		if (arena.size() > 1)
+			std::swap(arena.back(), arena[arena.size() - 2]);
+		return stored;
+	}
+
+	if (ARENA_BLOCK_SIZE - arenaUsed < name.size()) {
+		arena.emplace_back(new char[ARENA_BLOCK_SIZE]);
+		arenaUsed = 0;
+	}
+
+	char * dest = arena.back().get() + arenaUsed;
+	memcpy(dest, name.data(), name.size());
+	arenaUsed += name.size();
+
+	return std::string_view(dest, name.size());
+}
+
+PathId
+PathTree::Child(PathId parent, std::string_view name, bool create)
+{
+	auto it = children.find(ChildKey{parent, name});
+	if (it != children.end())
+		return it->second;
+
+	if (!create)
+		return INVALID;
+
+	PathId id = nodes.size();
+	std::string_view stored = Store(name);
+
+	nodes.push_back({parent, stored});
+	children.emplace(ChildKey{parent, stored}, id);
+
+	return id;
+}
+
+PathId
+PathTree::Walk(std::string_view path, bool create)
+{
+	PathId id = ROOT;
+	size_t pos = 0;
+
+	if (!path.empty() && path[0] == '/') {
+		id = Child(id, "/", create);
+		if (id == INVALID)
+			return INVALID;
+	}
+
+	while ((pos = path.find_first_not_of('/', pos)) != std::string_view::npos) {
+		size_t end = path.find('/', pos);
+		if (end == std::string_view::npos)
+			end = path.size();
+
+		id = Child(id, path.substr(pos, end - pos), create);
+		if (id == INVALID)
+			return INVALID;
+
+		pos = end;
+	}
+
+	return id;
+}
+
+Path
+PathTree::GetPath(PathId id) const
+{
+	size_t length = 0;
+
+	/*
+	 * Size the string first and then fill it in from the end, so that
+	 * the only allocation is the string that the Path takes over.
+	 */
+	for (PathId i = id; i != ROOT; i = nodes[i].parent) {
+		length += nodes[i].name.size();
+		if (NeedsSeparator(i))
+			length++;
+	}
+
+	std::string path(length, '\0');
+	for (PathId i = id; i != ROOT; i = nodes[i].parent) {
+		length -= nodes[i].name.size();
+		memcpy(&path[length], nodes[i].name.data(), nodes[i].name.size());
+		if (NeedsSeparator(i))
+			path[--length] = '/';
+	}
+
+	return Path(std::move(path));
+}
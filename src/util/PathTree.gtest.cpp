@@ -0,0 +1,105 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "PathTree.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+class PathTreeTestSuite : public ::testing::Test
+{
+};
+
+TEST_F(PathTreeTestSuite, TestIntern)
+{
+	PathTree tree;
+
+	PathId id = tree.Intern("/usr/include/stdio.h");
+	EXPECT_EQ(tree.Intern("/usr/include/stdio.h"), id);
+	EXPECT_EQ(tree.Intern("//usr/include//stdio.h/"), id);
+	EXPECT_EQ(tree.Find("/usr/include/stdio.h"), id);
+
+	EXPECT_NE(tree.Intern("usr/include/stdio.h"), id);
+	EXPECT_NE(tree.Intern("/usr/include"), id);
+}
+
+TEST_F(PathTreeTestSuite, TestFind)
+{
+	PathTree tree;
+
+	tree.Intern("/usr/include/stdio.h");
+	size_t size = tree.Size();
+
+	EXPECT_NE(tree.Find("/usr/include"), PathTree::INVALID);
+	EXPECT_EQ(tree.Find("/usr/include/stdlib.h"), PathTree::INVALID);
+	EXPECT_EQ(tree.Find("usr"), PathTree::INVALID);
+
+	/* Finding a path doesn't intern it. */
+	EXPECT_EQ(tree.Size(), size);
+}
+
+TEST_F(PathTreeTestSuite, TestGetParent)
+{
+	PathTree tree;
+
+	PathId file = tree.Intern("/usr/include/stdio.h");
+	PathId dir = tree.Find("/usr/include");
+	EXPECT_EQ(tree.GetParent(file), dir);
+	EXPECT_EQ(tree.GetParent(tree.GetParent(dir)), tree.Find("/"));
+	EXPECT_EQ(tree.GetParent(tree.Find("/")), PathTree::ROOT);
+
+	EXPECT_EQ(tree.GetParent(tree.Intern("obj")), PathTree::ROOT);
+	EXPECT_EQ(tree.GetParent(tree.Intern("obj/foo.o")), tree.Find("obj"));
+}
+
+TEST_F(PathTreeTestSuite, TestRoundTrip)
+{
+	PathTree tree;
+
+	for (const char * path : {"/", "/usr/include/stdio.h", "obj/foo.o", "a"}) {
+		EXPECT_EQ(tree.GetPath(tree.Intern(path)).string(), path);
+	}
+
+	EXPECT_EQ(tree.GetPath(tree.Intern("/usr//lib/")).string(), "/usr/lib");
+}
+
+TEST_F(PathTreeTestSuite, TestLongNames)
+{
+	PathTree tree;
+
+	/* Longer than an arena block, in between two short names. */
+	std::string longName(70000, 'x');
+	PathId before = tree.Intern("/tmp/before");
+	PathId longId = tree.Intern("/tmp/" + longName);
+	PathId after = tree.Intern("/tmp/after");
+
+	EXPECT_EQ(tree.GetPath(before).string(), "/tmp/before");
+	EXPECT_EQ(tree.GetPath(longId).string(), "/tmp/" + longName);
+	EXPECT_EQ(tree.GetPath(after).string(), "/tmp/after");
+}
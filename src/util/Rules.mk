@@ -2,5 +2,32 @@
 LIB := util
 
 SRCS := \
+	Depfile.cpp \
+	Digest.cpp \
+	DirSnapshot.cpp \
+	FileStat.cpp \
+	MappedFile.cpp \
+	PathTree.cpp \
+	StatCache.cpp \
+	StateFile.cpp \
 	VectorUtil.cpp \
 
+
+TESTS := \
+	Depfile \
+	Digest \
+	DirSnapshot \
+	PathTree \
+
+TEST_DEPFILE_SRCS := \
+	Depfile.cpp \
+
+TEST_DIGEST_SRCS := \
+	Digest.cpp \
+	MappedFile.cpp \
+
+TEST_DIRSNAPSHOT_SRCS := \
+	DirSnapshot.cpp \
+
+TEST_PATHTREE_SRCS := \
+	PathTree.cpp \
@@ -0,0 +1,159 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2020 Ryan Stone
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "StateFile.h"
+
+#include "FileDesc.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+Path
+GetStateFilePath(std::string_view name)
+{
+	return Path(FACTORY_STATE_DIR) / Path(name);
+}
+
+StateFileWriter::StateFileWriter(uint32_t magic, uint32_t version)
+{
+	Write(magic);
+	Write(version);
+}
+
+void
+StateFileWriter::WriteString(std::string_view str)
+{
+	Write(static_cast<uint32_t>(str.size()));
+	buf.append(str);
+}
+
+void
+StateFileWriter::WriteStringList(const std::vector<std::string> & list)
+{
+	Write(static_cast<uint32_t>(list.size()));
+	for (const std::string & str : list) {
+		WriteString(str);
+	}
+}
+
+bool
+StateFileWriter::Commit(const Path & path)
+{
+	Path parent = path.parent_path();
+	if (!parent.empty() && mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST)
+		return false;
+
+	/*
+	 * The temporary file is unique, as a daemon build and another factory
+	 * in the same tree may be committing the same file at once.  The last
+	 * rename() wins, but every file renamed into place is whole.
+	 */
+	std::string tmpPath = path.string() + ".XXXXXX";
+	FileDesc fd(mkostemp(tmpPath.data(), O_CLOEXEC));
+	if (!fd)
+		return false;
+
+	if (fchmod(fd, 0644) != 0) {
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	const char * next = buf.data();
+	size_t left = buf.size();
+	while (left > 0) {
+		ssize_t bytes = write(fd, next, left);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			unlink(tmpPath.c_str());
+			return false;
+		}
+		next += bytes;
+		left -= bytes;
+	}
+
+	fd.Close();
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+StateFileReader::StateFileReader()
+  : pos(0),
+    failed(false)
+{
+}
+
+bool
+StateFileReader::Open(const Path & path, uint32_t magic, uint32_t version)
+{
+	if (!file.Open(path))
+		return false;
+
+	data = file.GetContents();
+	pos = 0;
+	failed = false;
+
+	uint32_t fileMagic = Read<uint32_t>();
+	uint32_t fileVersion = Read<uint32_t>();
+
+	return !failed && fileMagic == magic && fileVersion == version;
+}
+
+std::string_view
+StateFileReader::ReadString()
+{
+	uint32_t len = Read<uint32_t>();
+	if (!Consume(len))
+		return std::string_view();
+
+	std::string_view str = data.substr(pos, len);
+	pos += len;
+	return str;
+}
+
+std::vector<std::string>
+StateFileReader::ReadStringList()
+{
+	std::vector<std::string> list;
+	uint32_t count = Read<uint32_t>();
+
+	for (uint32_t i = 0; i < count && !failed; ++i) {
+		list.emplace_back(ReadString());
+	}
+
+	return list;
+}